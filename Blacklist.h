@@ -0,0 +1,95 @@
+#ifndef __BLACKLIST_H
+#define __BLACKLIST_H
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "Config.h"
+#include "PerConfig.h"
+
+namespace ramulator {
+
+    // BLISS blacklisting unit. A core that gets more than `threshold`
+    // requests served in a row is blacklisted, and the blacklist is
+    // cleared at the start of every clearing interval. One unit is shared
+    // by the controllers of all channels built from the same Config, so
+    // that a streaming core is caught even if its requests interleave
+    // across channels.
+    //
+    // Config options:
+    //   bliss_threshold         - consecutive requests (default 4)
+    //   bliss_clearing_interval - memory cycles (default 10000)
+    class Blacklist {
+    public:
+        int threshold = 4;  // Noted in page 8, first bullet at bottom
+        long clearing_interval = 10000;
+
+        int lastCoreID = 0;    // Used to track the core ID of the last request
+        long numRequests = 0;  // Number of requests served from an application
+        // Used to track the blacklist status of the cores, one bit per core
+        uint64_t bStatus = 0;
+        uint64_t all_cores;  // bStatus with every core blacklisted
+
+        Blacklist(const Config& configs) {
+            int core_num = configs.get_core_num();
+            assert(core_num <= 64);  // bStatus has a bit per core
+            all_cores = core_num == 64 ? ~0ull : (1ull << core_num) - 1;
+
+            if (configs.contains("bliss_threshold")) {
+                threshold = std::stoi(configs["bliss_threshold"]);
+            }
+            if (configs.contains("bliss_clearing_interval")) {
+                clearing_interval =
+                    std::stol(configs["bliss_clearing_interval"]);
+                assert(clearing_interval > 0);
+            }
+        }
+
+        // The unit of the channels built from configs
+        static std::shared_ptr<Blacklist> get(const Config& configs) {
+            return shared_per_config<Blacklist>(configs, configs);
+        }
+
+        // Called by every controller each cycle it ticks. Clears the
+        // blacklist once per interval, also after cycles were skipped.
+        void update(long clk) {
+            long epoch = clk / clearing_interval;
+            if (epoch != cur_epoch) {
+                cur_epoch = epoch;
+                bStatus = 0;
+            }
+        }
+
+        // A request of coreid is scheduled on any channel
+        void serve(int coreid) {
+            if (coreid == lastCoreID) {
+                // If the core ID is the same as the last one, increment
+                numRequests++;
+            } else {
+                // If the core ID is different, reset the counter
+                numRequests = 0;
+            }
+
+            // Check against the threshold
+            if (numRequests >= threshold) {
+                bStatus |= 1ull << coreid;
+                numRequests = 0;
+            }
+
+            // Update the last core ID
+            lastCoreID = coreid;
+        }
+
+        bool is_blacklisted(int coreid) const {
+            return (bStatus >> coreid) & 1;
+        }
+
+    private:
+        long cur_epoch = 0;
+    };
+
+}  // namespace ramulator
+
+#endif /* __BLACKLIST_H */
@@ -24,7 +24,8 @@ namespace ramulator {
           size(size),
           assoc(assoc),
           block_size(block_size),
-          mshr_entry_num(mshr_entry_num) {
+          mshr_entry_num(mshr_entry_num),
+          mshr(mshr_entry_num) {
         debug("level %d size %d assoc %d block_size %d\n", int(level), size,
               assoc, block_size);
 
@@ -38,6 +39,7 @@ namespace ramulator {
 
         is_first_level = (level == cachesys->first_level);
         is_last_level = (level == cachesys->last_level);
+        cachesys->caches.push_back(this);
 
         // Check size, block size and assoc are 2^N
         assert((size & (size - 1)) == 0);
@@ -51,6 +53,72 @@ namespace ramulator {
         index_offset = calc_log2(block_size);
         tag_offset = calc_log2(block_num) + index_offset;
 
+        // 18-740 QoS: bind the cache core instantiated for the mode
+        switch (cachesys->cache_qos) {
+            case CacheSystem::Cache_QoS::way_partitioning:
+                bind_qos<WayPartitioningQoS>();
+                break;
+            case CacheSystem::Cache_QoS::custom:
+                bind_qos<CustomQoS>();
+                break;
+            default:
+                bind_qos<BasicQoS>();
+                break;
+        }
+
+        // Allocate all sets up front
+        cache_lines.resize(size_t(block_num) * assoc);
+
+        // The configured replacement policy manages the last level, the
+        // private levels stay LRU
+        ReplacementPolicy::Type repl_type = ReplacementPolicy::Type::LRU;
+        if (is_last_level) {
+            repl_type = cachesys->replacement;
+        }
+        repl.reset(ReplacementPolicy::create(
+            repl_type, int(block_num), int(assoc)));
+
+        all_ways = assoc == 64 ? ~0ull : (1ull << assoc) - 1;
+        if (cachesys->cache_qos == CacheSystem::Cache_QoS::way_partitioning &&
+            is_last_level) {
+            if (cachesys->way_masks.size()) {
+                way_masks = cachesys->way_masks;
+                for (uint64_t mask : way_masks) {
+                    if (mask & ~all_ways) {
+                        fprintf(stderr, "way mask %llx is not within the %u "
+                                "ways of the last level cache\n",
+                                (unsigned long long)mask, assoc);
+                        exit(1);
+                    }
+                }
+            } else {
+                ucp.reset(new UCP(cachesys->core_num, block_num, assoc,
+                                  cachesys->ucp_epoch));
+                update_way_masks();
+            }
+        }
+
+        // The prefetcher sits at the shared L3 and sees every core
+        if (level == Level::L3 &&
+            cachesys->prefetcher != Prefetcher::Type::None) {
+            prefetcher.reset(new Prefetcher(cachesys->prefetcher,
+                                            cachesys->prefetch_degree,
+                                            block_size, cachesys->core_num));
+            cachesys->llc = this;
+            cachesys->prefetch_tags->drop = [this](const Request& req) {
+                return drop_prefetch(req);
+            };
+        }
+
+        if (level == Level::L3) {
+            cachesys->writeback_link->set_line_size(block_size);
+            cachesys->writeback_link->clean =
+                [this](const std::vector<long>& addrs, size_t max,
+                       std::vector<long>& out) {
+                    clean_dirty_lines(addrs, max, out);
+                };
+        }
+
         debug("index_offset %d", index_offset);
         debug("index_mask 0x%x", index_mask);
         debug("tag_offset %d", tag_offset);
@@ -95,739 +163,485 @@ namespace ramulator {
             .name(level_string + string("_cache_set_unavailable"))
             .desc("cache set not available")
             .precision(0);
-    }
-
-    bool Cache::send(Request req) {
-        // 18-740 QoS: Way Partitioning
-        if (cachesys->cache_qos == CacheSystem::Cache_QoS::way_partitioning) {
-            debug("level %d req.addr %lx req.type %d, index %d, tag %ld",
-                  int(level), req.addr, int(req.type), get_index(req.addr),
-                  get_tag(req.addr));
-
-            cache_total_access++;
-            if (req.type == Request::Type::WRITE) {
-                cache_write_access++;
-            } else {
-                assert(req.type == Request::Type::READ);
-                cache_read_access++;
+        cache_mshr_occupancy_sum
+            .name(level_string + string("_cache_mshr_occupancy_sum"))
+            .desc("sum of busy mshr entries per cycle")
+            .precision(0);
+        cache_mshr_occupancy_avg
+            .name(level_string + string("_cache_mshr_occupancy_avg"))
+            .desc("average busy mshr entries per cycle")
+            .precision(6);
+        cache_mshr_occupancy_max
+            .name(level_string + string("_cache_mshr_occupancy_max"))
+            .desc("maximum busy mshr entries in a cycle")
+            .precision(0);
+        cache_mshr_merge_depth_avg
+            .name(level_string + string("_cache_mshr_merge_depth_avg"))
+            .desc("average requests merged into a retired mshr entry")
+            .precision(6);
+        cache_mshr_merge_depth_max
+            .name(level_string + string("_cache_mshr_merge_depth_max"))
+            .desc("maximum requests merged into one mshr entry")
+            .precision(0);
+        cache_mshr_retired.name(level_string + string("_cache_mshr_retired"))
+            .desc("number of mshr entries retired by a fill")
+            .precision(0);
+        if (way_masks.size()) {
+            cache_way_quota.init(cachesys->core_num)
+                .name(level_string + string("_cache_way_quota"))
+                .desc("ways of each set the core may allocate lines in")
+                .precision(0);
+            for (int core = 0; core < cachesys->core_num; core++) {
+                set_way_mask(core, way_masks[core]);
             }
-            // If there isn't a set, create it.
-            auto& lines = get_lines_waypart(req.addr, req.coreid);
-            std::list<Line>::iterator line;
-
-            if (is_hit(lines, req.addr, &line)) {
-                lines.push_back(
-                    Line(req.addr, get_tag(req.addr), false,
-                         line->dirty || (req.type == Request::Type::WRITE)));
-                lines.erase(line);
-                cachesys->hit_list.push_back(
-                    make_pair(cachesys->clk + latency[int(level)], req));
-
-                debug("hit, update timestamp %ld", cachesys->clk);
-                debug("hit finish time %ld",
-                      cachesys->clk + latency[int(level)]);
-
-                return true;
-
-            } else {
-                debug("miss @level %d", int(level));
-                cache_total_miss++;
-                if (req.type == Request::Type::WRITE) {
-                    cache_write_miss++;
-                } else {
-                    assert(req.type == Request::Type::READ);
-                    cache_read_miss++;
-                }
-
-                // The dirty bit will be set if this is a write request and @L1
-                bool dirty = (req.type == Request::Type::WRITE);
-
-                // Modify the type of the request to lower level
-                if (req.type == Request::Type::WRITE) {
-                    req.type = Request::Type::READ;
-                }
-
-                // Look it up in MSHR entries
-                assert(req.type == Request::Type::READ);
-                auto mshr = hit_mshr(req.addr);
-                if (mshr != mshr_entries.end()) {
-                    debug("hit mshr");
-                    cache_mshr_hit++;
-                    mshr->second->dirty = dirty || mshr->second->dirty;
-                    return true;
-                }
-
-                // All requests come to this stage will be READ, so they
-                // should be recorded in MSHR entries.
-                if (mshr_entries.size() == mshr_entry_num) {
-                    // When no MSHR entries available, the miss request
-                    // is stalling.
-                    cache_mshr_unavailable++;
-                    debug("no mshr entry available");
-                    return false;
-                }
+        }
+        if (prefetcher) {
+            prefetches_issued
+                .name(level_string + string("_prefetches_issued"))
+                .desc("number of prefetches sent to memory")
+                .precision(0);
+            prefetches_useful
+                .name(level_string + string("_prefetches_useful"))
+                .desc("number of prefetched lines used by a demand request")
+                .precision(0);
+            prefetches_late.name(level_string + string("_prefetches_late"))
+                .desc("number of prefetches a demand request waited for")
+                .precision(0);
+            prefetches_dropped
+                .name(level_string + string("_prefetches_dropped"))
+                .desc("number of prefetches dropped by a full memory queue")
+                .precision(0);
+            prefetch_accuracy
+                .name(level_string + string("_prefetch_accuracy"))
+                .desc("useful prefetches per prefetch issued")
+                .precision(6);
+            prefetch_coverage
+                .name(level_string + string("_prefetch_coverage"))
+                .desc("demand misses removed by a prefetch per demand miss "
+                      "without prefetching")
+                .precision(6);
+            prefetch_lateness
+                .name(level_string + string("_prefetch_lateness"))
+                .desc("late prefetches per useful prefetch")
+                .precision(6);
+        }
 
-                // Check whether there is a line available
-                if (all_sets_locked(lines)) {
-                    cache_set_unavailable++;
-                    return false;
-                }
+        if (level == Level::L3) {
+            cache_early_writeback
+                .name(level_string + string("_cache_early_writeback"))
+                .desc("number of dirty lines written back before eviction")
+                .precision(0);
+        }
 
-                auto newline = allocate_line(lines, req);
-                if (newline == lines.end()) {
-                    return false;
-                }
+        if (level == Level::L3 && cachesys->series) {
+            TimeSeries* series = cachesys->series.get();
+            series->add("L3_accesses",
+                        [this] { return cache_total_access.value(); });
+            series->add("L3_misses",
+                        [this] { return cache_total_miss.value(); });
+            series->add("L3_mshr_occupancy", [this] { return mshr.size(); });
+        }
+    }
 
-                newline->dirty = dirty;
+    template <typename QoS>
+    void Cache::bind_qos() {
+        send_fn = &Cache::do_send<QoS>;
+        evictline_fn = &Cache::do_evictline<QoS>;
+        invalidate_fn = &Cache::do_invalidate<QoS>;
+    }
 
-                // Add to MSHR entries
-                mshr_entries.push_back(make_pair(req.addr, newline));
+    template <typename QoS>
+    bool Cache::do_send(Request req) {
+        debug("level %d req.addr %lx req.type %d, index %d, tag %ld",
+              int(level), req.addr, int(req.type), get_index(req.addr),
+              get_tag(req.addr));
 
-                // Send the request to next level;
-                if (!is_last_level) {
-                    if (!lower_cache->send(req)) {
-                        retry_list.push_back(req);
-                    }
-                } else {
-                    cachesys->wait_list.push_back(
-                        make_pair(cachesys->clk + latency[int(level)], req));
+        cache_total_access++;
+        if (req.type == Request::Type::WRITE) {
+            cache_write_access++;
+        } else {
+            assert(req.type == Request::Type::READ);
+            cache_read_access++;
+        }
+        // Locate the set in the tag store.
+        auto lines = QoS::get_lines(this, req.addr, req.coreid);
+        Line* line;
+
+        if (ucp) {
+            long repartitions = ucp->repartitions;
+            ucp->access(req.coreid, get_index(req.addr), get_tag(req.addr),
+                        cachesys->clk);
+            if (ucp->repartitions != repartitions) {
+                update_way_masks();
+                for (int core = 0; core < cachesys->core_num; core++) {
+                    set_way_mask(core, way_masks[core]);
                 }
-                return true;
             }
         }
-        // 18-740 QoS: Custom QoS
-        else if (cachesys->cache_qos == CacheSystem::Cache_QoS::custom) {
-            debug("level %d req.addr %lx req.type %d, index %d, tag %ld",
-                  int(level), req.addr, int(req.type), get_index(req.addr),
-                  get_tag(req.addr));
 
-            cache_total_access++;
-            if (req.type == Request::Type::WRITE) {
-                cache_write_access++;
-            } else {
-                assert(req.type == Request::Type::READ);
-                cache_read_access++;
+        if (is_hit(lines, req.addr, &line)) {
+            line->dirty = line->dirty || (req.type == Request::Type::WRITE);
+            repl->hit(get_set(line), get_way(line), req);
+            if (line->prefetch >= 0) {
+                // First use of a prefetched line, keep the stream going
+                cachesys->prefetch_tags->use(line->prefetch);
+                line->prefetch = -1;
+                prefetches_useful++;
+                issue_prefetches<QoS>(req.coreid, req.addr);
             }
-            // If there isn't a set, create it.
-            auto& lines = get_lines(req.addr);
-            std::list<Line>::iterator line;
-
-            if (is_hit(lines, req.addr, &line)) {
-                lines.push_back(
-                    Line(req.addr, get_tag(req.addr), false,
-                         line->dirty || (req.type == Request::Type::WRITE)));
-                lines.erase(line);
-                cachesys->hit_list.push_back(
-                    make_pair(cachesys->clk + latency[int(level)], req));
-
-                debug("hit, update timestamp %ld", cachesys->clk);
-                debug("hit finish time %ld",
-                      cachesys->clk + latency[int(level)]);
+            cachesys->hit_list.push(cachesys->clk + latency[int(level)],
+                                    std::move(req));
 
-                return true;
+            debug("hit, update timestamp %ld", cachesys->clk);
+            debug("hit finish time %ld", cachesys->clk + latency[int(level)]);
 
-            } else {
-                debug("miss @level %d", int(level));
-                cache_total_miss++;
-                if (req.type == Request::Type::WRITE) {
-                    cache_write_miss++;
-                } else {
-                    assert(req.type == Request::Type::READ);
-                    cache_read_miss++;
-                }
-
-                // The dirty bit will be set if this is a write request and @L1
-                bool dirty = (req.type == Request::Type::WRITE);
+            return true;
 
-                // Modify the type of the request to lower level
-                if (req.type == Request::Type::WRITE) {
-                    req.type = Request::Type::READ;
-                }
-
-                // Look it up in MSHR entries
+        } else {
+            debug("miss @level %d", int(level));
+            cache_total_miss++;
+            if (req.type == Request::Type::WRITE) {
+                cache_write_miss++;
+            } else {
                 assert(req.type == Request::Type::READ);
-                auto mshr = hit_mshr(req.addr);
-                if (mshr != mshr_entries.end()) {
-                    debug("hit mshr");
-                    cache_mshr_hit++;
-                    mshr->second->dirty = dirty || mshr->second->dirty;
-                    return true;
-                }
-
-                // All requests come to this stage will be READ, so they
-                // should be recorded in MSHR entries.
-                if (mshr_entries.size() == mshr_entry_num) {
-                    // When no MSHR entries available, the miss request
-                    // is stalling.
-                    cache_mshr_unavailable++;
-                    debug("no mshr entry available");
-                    return false;
-                }
-
-                // Check whether there is a line available
-                if (all_sets_locked(lines)) {
-                    cache_set_unavailable++;
-                    return false;
-                }
-
-                auto newline = allocate_line(lines, req);
-                if (newline == lines.end()) {
-                    return false;
-                }
+                cache_read_miss++;
+            }
 
-                newline->dirty = dirty;
+            // The dirty bit will be set if this is a write request and @L1
+            bool dirty = (req.type == Request::Type::WRITE);
 
-                // Add to MSHR entries
-                mshr_entries.push_back(make_pair(req.addr, newline));
+            // Modify the type of the request to lower level
+            if (req.type == Request::Type::WRITE) {
+                req.type = Request::Type::READ;
+            }
 
-                // Send the request to next level;
-                if (!is_last_level) {
-                    if (!lower_cache->send(req)) {
-                        retry_list.push_back(req);
-                    }
-                } else {
-                    cachesys->wait_list.push_back(
-                        make_pair(cachesys->clk + latency[int(level)], req));
-                }
+            // Look it up in MSHR entries
+            assert(req.type == Request::Type::READ);
+            auto entry = hit_mshr(req.addr);
+            if (entry != nullptr) {
+                debug("hit mshr");
+                cache_mshr_hit++;
+                entry->line->dirty = dirty || entry->line->dirty;
+                if (entry->prefetch) {
+                    // The prefetch is late, it now carries a demand request
+                    entry->prefetch = false;
+                    cachesys->prefetch_tags->promote(entry->addr);
+                    cachesys->prefetch_tags->use(entry->line->prefetch);
+                    entry->line->prefetch = -1;
+                    prefetches_useful++;
+                    prefetches_late++;
+                    update_prefetch_stats();
+                }
+                // Track the merged request, it completes with the fill
+                entry->targets.push_back(std::move(req));
                 return true;
             }
-        }
-        // 18-740 QoS: None (baseline cache)
-        else {
-            debug("level %d req.addr %lx req.type %d, index %d, tag %ld",
-                  int(level), req.addr, int(req.type), get_index(req.addr),
-                  get_tag(req.addr));
 
-            cache_total_access++;
-            if (req.type == Request::Type::WRITE) {
-                cache_write_access++;
-            } else {
-                assert(req.type == Request::Type::READ);
-                cache_read_access++;
+            // All requests come to this stage will be READ, so they
+            // should be recorded in MSHR entries.
+            if (mshr.full()) {
+                // When no MSHR entries available, the miss request
+                // is stalling.
+                cache_mshr_unavailable++;
+                debug("no mshr entry available");
+                return false;
             }
-            // If there isn't a set, create it.
-            auto& lines = get_lines(req.addr);
-            std::list<Line>::iterator line;
-
-            if (is_hit(lines, req.addr, &line)) {
-                lines.push_back(
-                    Line(req.addr, get_tag(req.addr), false,
-                         line->dirty || (req.type == Request::Type::WRITE)));
-                lines.erase(line);
-                cachesys->hit_list.push_back(
-                    make_pair(cachesys->clk + latency[int(level)], req));
-
-                debug("hit, update timestamp %ld", cachesys->clk);
-                debug("hit finish time %ld",
-                      cachesys->clk + latency[int(level)]);
-
-                return true;
 
-            } else {
-                debug("miss @level %d", int(level));
-                cache_total_miss++;
-                if (req.type == Request::Type::WRITE) {
-                    cache_write_miss++;
-                } else {
-                    assert(req.type == Request::Type::READ);
-                    cache_read_miss++;
-                }
+            // Check whether there is a line available
+            if (all_sets_locked(lines)) {
+                cache_set_unavailable++;
+                return false;
+            }
 
-                // The dirty bit will be set if this is a write request and @L1
-                bool dirty = (req.type == Request::Type::WRITE);
+            auto newline = allocate_line<QoS>(lines, req);
+            if (newline == nullptr) {
+                return false;
+            }
 
-                // Modify the type of the request to lower level
-                if (req.type == Request::Type::WRITE) {
-                    req.type = Request::Type::READ;
-                }
+            newline->dirty = dirty;
 
-                // Look it up in MSHR entries
-                assert(req.type == Request::Type::READ);
-                auto mshr = hit_mshr(req.addr);
-                if (mshr != mshr_entries.end()) {
-                    debug("hit mshr");
-                    cache_mshr_hit++;
-                    mshr->second->dirty = dirty || mshr->second->dirty;
-                    return true;
-                }
+            // Add to MSHR entries
+            mshr.allocate(align(req.addr), newline);
 
-                // All requests come to this stage will be READ, so they
-                // should be recorded in MSHR entries.
-                if (mshr_entries.size() == mshr_entry_num) {
-                    // When no MSHR entries available, the miss request
-                    // is stalling.
-                    cache_mshr_unavailable++;
-                    debug("no mshr entry available");
-                    return false;
+            // Send the request to next level;
+            int coreid = req.coreid;
+            long addr = req.addr;
+            if (!is_last_level) {
+                if (!lower_cache->send(req)) {
+                    retry_list.push_back(req);
                 }
+            } else {
+                cachesys->wait_list.push(cachesys->clk + latency[int(level)],
+                                         std::move(req));
+            }
+            if (prefetcher) issue_prefetches<QoS>(coreid, addr);
+            return true;
+        }
+    }
 
-                // Check whether there is a line available
-                if (all_sets_locked(lines)) {
-                    cache_set_unavailable++;
-                    return false;
-                }
+    template <typename QoS>
+    void Cache::do_evictline(long addr, bool dirty, int coreid) {
+        auto line = find_line(QoS::get_lines(this, addr, coreid), addr);
 
-                auto newline = allocate_line(lines, req);
-                if (newline == lines.end()) {
-                    return false;
-                }
+        assert(line != nullptr);  // check inclusive cache
+        // Update LRU queue. The dirty bit will be set if the dirty
+        // bit inherited from higher level(s) is set.
+        line->lock = false;
+        line->dirty = dirty || line->dirty;
+        repl->touch(get_set(line), get_way(line));
+    }
 
-                newline->dirty = dirty;
+    template <typename QoS>
+    std::pair<long, bool> Cache::do_invalidate(long addr, int coreid) {
+        long delay = latency_each[int(level)];
+        bool dirty = false;
 
-                // Add to MSHR entries
-                mshr_entries.push_back(make_pair(req.addr, newline));
+        auto lines = QoS::get_lines(this, addr, coreid);
+        if (valid_lines(lines) == 0) {
+            // The line of this address doesn't exist.
+            return make_pair(0, false);
+        }
+        auto line = find_line(lines, addr);
+
+        // If the line is in this level cache, then free its way.
+        if (line != nullptr) {
+            assert(!line->lock);
+            debug("invalidate %lx @ level %d", addr, int(level));
+            line->valid = false;
+            repl->evict(get_set(line), get_way(line));
+        } else {
+            // If it's not in current level, then no need to go up.
+            return make_pair(delay, false);
+        }
 
-                // Send the request to next level;
-                if (!is_last_level) {
-                    if (!lower_cache->send(req)) {
-                        retry_list.push_back(req);
-                    }
+        if (higher_cache.size()) {
+            long max_delay = delay;
+            for (auto hc : higher_cache) {
+                auto result = hc->invalidate(addr, coreid);
+                if (result.second) {
+                    max_delay = max(max_delay, delay + result.first * 2);
                 } else {
-                    cachesys->wait_list.push_back(
-                        make_pair(cachesys->clk + latency[int(level)], req));
+                    max_delay = max(max_delay, delay + result.first);
                 }
-                return true;
+                dirty = dirty || line->dirty || result.second;
             }
+            delay = max_delay;
+        } else {
+            dirty = line->dirty;
         }
+        return make_pair(delay, dirty);
     }
 
-    void Cache::evictline(long addr, bool dirty, int coreid) {
-        // 18-740 QoS: Way Partitioning
-        if (cachesys->cache_qos == CacheSystem::Cache_QoS::way_partitioning) {
-            auto it = cache_lines_wp[coreid].find(get_index(addr));
-            assert(it !=
-                   cache_lines_wp[coreid].end());  // check inclusive cache
-            auto& lines = it->second;
-            auto line = find_if(
-                lines.begin(), lines.end(),
-                [addr, this](Line l) { return (l.tag == get_tag(addr)); });
-
-            assert(line != lines.end());
-            // Update LRU queue. The dirty bit will be set if the dirty
-            // bit inherited from higher level(s) is set.
-            lines.push_back(
-                Line(addr, get_tag(addr), false, dirty || line->dirty));
-            lines.erase(line);
-        }
-        // 18-740 QoS: Custom QoS
-        else if (cachesys->cache_qos == CacheSystem::Cache_QoS::custom) {
-            auto it = cache_lines.find(get_index(addr));
-            assert(it != cache_lines.end());  // check inclusive cache
-            auto& lines = it->second;
-            auto line = find_if(
-                lines.begin(), lines.end(),
-                [addr, this](Line l) { return (l.tag == get_tag(addr)); });
-
-            assert(line != lines.end());
-            // Update LRU queue. The dirty bit will be set if the dirty
-            // bit inherited from higher level(s) is set.
-            lines.push_back(
-                Line(addr, get_tag(addr), false, dirty || line->dirty));
-            lines.erase(line);
-        }
-        // 18-740 QoS: None (baseline cache)
-        else {
-            auto it = cache_lines.find(get_index(addr));
-            assert(it != cache_lines.end());  // check inclusive cache
-            auto& lines = it->second;
-            auto line = find_if(
-                lines.begin(), lines.end(),
-                [addr, this](Line l) { return (l.tag == get_tag(addr)); });
-
-            assert(line != lines.end());
-            // Update LRU queue. The dirty bit will be set if the dirty
-            // bit inherited from higher level(s) is set.
-            lines.push_back(
-                Line(addr, get_tag(addr), false, dirty || line->dirty));
-            lines.erase(line);
-        }
-    }
-
-    std::pair<long, bool> Cache::invalidate(long addr, int coreid) {
-        // 18-740 QoS: Way Partitioning
-        if (cachesys->cache_qos == CacheSystem::Cache_QoS::way_partitioning) {
-            long delay = latency_each[int(level)];
-            bool dirty = false;
+    void Cache::evict(Line* victim, int coreid) {
+        debug("level %d miss evict victim %lx", int(level), victim->addr);
+        cache_eviction++;
 
-            auto& lines = get_lines_waypart(addr, coreid);
-            if (lines.size() == 0) {
-                // The line of this address doesn't exist.
-                return make_pair(0, false);
-            }
-            auto line = find_if(
-                lines.begin(), lines.end(),
-                [addr, this](Line l) { return (l.tag == get_tag(addr)); });
-
-            // If the line is in this level cache, then erase it from
-            // the buffer.
-            if (line != lines.end()) {
-                assert(!line->lock);
-                debug("invalidate %lx @ level %d", addr, int(level));
-                lines.erase(line);
-            } else {
-                // If it's not in current level, then no need to go up.
-                return make_pair(delay, false);
-            }
+        long addr = victim->addr;
+        long invalidate_time = 0;
+        bool dirty = victim->dirty;
 
-            if (higher_cache.size()) {
-                long max_delay = delay;
-                for (auto hc : higher_cache) {
-                    auto result = hc->invalidate(addr, coreid);
-                    if (result.second) {
-                        max_delay = max(max_delay, delay + result.first * 2);
-                    } else {
-                        max_delay = max(max_delay, delay + result.first);
-                    }
-                    dirty = dirty || line->dirty || result.second;
-                }
-                delay = max_delay;
-            } else {
-                dirty = line->dirty;
+        // First invalidate the victim line in higher level.
+        if (higher_cache.size()) {
+            for (auto hc : higher_cache) {
+                auto result = hc->invalidate(addr, coreid);
+                invalidate_time =
+                    max(invalidate_time,
+                        result.first +
+                            (result.second ? latency_each[int(level)] : 0));
+                dirty = dirty || result.second || victim->dirty;
             }
-            return make_pair(delay, dirty);
         }
-        // 18-740 QoS: Custom QoS
-        else if (cachesys->cache_qos == CacheSystem::Cache_QoS::custom) {
-            long delay = latency_each[int(level)];
-            bool dirty = false;
 
-            auto& lines = get_lines(addr);
-            if (lines.size() == 0) {
-                // The line of this address doesn't exist.
-                return make_pair(0, false);
-            }
-            auto line = find_if(
-                lines.begin(), lines.end(),
-                [addr, this](Line l) { return (l.tag == get_tag(addr)); });
-
-            // If the line is in this level cache, then erase it from
-            // the buffer.
-            if (line != lines.end()) {
-                assert(!line->lock);
-                debug("invalidate %lx @ level %d", addr, int(level));
-                lines.erase(line);
-            } else {
-                // If it's not in current level, then no need to go up.
-                return make_pair(delay, false);
-            }
+        debug("invalidate delay: %ld, dirty: %s", invalidate_time,
+              dirty ? "true" : "false");
 
-            if (higher_cache.size()) {
-                long max_delay = delay;
-                for (auto hc : higher_cache) {
-                    auto result = hc->invalidate(addr, coreid);
-                    if (result.second) {
-                        max_delay = max(max_delay, delay + result.first * 2);
-                    } else {
-                        max_delay = max(max_delay, delay + result.first);
-                    }
-                    dirty = dirty || line->dirty || result.second;
-                }
-                delay = max_delay;
-            } else {
-                dirty = line->dirty;
+        if (!is_last_level) {
+            // not LLC eviction
+            assert(lower_cache != nullptr);
+            lower_cache->evictline(addr, dirty, coreid);
+        } else {
+            // LLC eviction
+            if (dirty) {
+                Request write_req(addr, Request::Type::WRITE);
+                cachesys->wait_list.push(
+                    cachesys->clk + invalidate_time + latency[int(level)],
+                    std::move(write_req));
+
+                debug(
+                    "inject one write request to memory system "
+                    "addr %lx, invalidate time %ld, issue time %ld",
+                    addr, invalidate_time,
+                    cachesys->clk + invalidate_time + latency[int(level)]);
             }
-            return make_pair(delay, dirty);
         }
-        // 18-740 QoS: None (baseline cache)
-        else {
-            long delay = latency_each[int(level)];
-            bool dirty = false;
 
-            auto& lines = get_lines(addr);
-            if (lines.size() == 0) {
-                // The line of this address doesn't exist.
-                return make_pair(0, false);
-            }
-            auto line = find_if(
-                lines.begin(), lines.end(),
-                [addr, this](Line l) { return (l.tag == get_tag(addr)); });
-
-            // If the line is in this level cache, then erase it from
-            // the buffer.
-            if (line != lines.end()) {
-                assert(!line->lock);
-                debug("invalidate %lx @ level %d", addr, int(level));
-                lines.erase(line);
-            } else {
-                // If it's not in current level, then no need to go up.
-                return make_pair(delay, false);
-            }
-
-            if (higher_cache.size()) {
-                long max_delay = delay;
-                for (auto hc : higher_cache) {
-                    auto result = hc->invalidate(addr, coreid);
-                    if (result.second) {
-                        max_delay = max(max_delay, delay + result.first * 2);
-                    } else {
-                        max_delay = max(max_delay, delay + result.first);
-                    }
-                    dirty = dirty || line->dirty || result.second;
-                }
-                delay = max_delay;
-            } else {
-                dirty = line->dirty;
-            }
-            return make_pair(delay, dirty);
-        }
+        victim->valid = false;
+        repl->evict(get_set(victim), get_way(victim));
     }
 
-    void Cache::evict(std::list<Line>* lines, std::list<Line>::iterator victim,
-                      int coreid) {
-        // 18-740 QoS: Way Partitioning
-        if (cachesys->cache_qos == CacheSystem::Cache_QoS::way_partitioning) {
-            debug("level %d miss evict victim %lx", int(level), victim->addr);
-            cache_eviction++;
-
-            long addr = victim->addr;
-            long invalidate_time = 0;
-            bool dirty = victim->dirty;
-
-            // First invalidate the victim line in higher level.
-            if (higher_cache.size()) {
-                for (auto hc : higher_cache) {
-                    auto result = hc->invalidate(addr, coreid);
-                    invalidate_time =
-                        max(invalidate_time,
-                            result.first +
-                                (result.second ? latency_each[int(level)] : 0));
-                    dirty = dirty || result.second || victim->dirty;
-                }
-            }
+    // * This function header was modified to pass down core values to other
+    //    functions.
+    template <typename QoS>
+    Cache::Line* Cache::allocate_line(Line* lines, const Request& req) {
+        long addr = req.addr;
 
-            debug("invalidate delay: %ld, dirty: %s", invalidate_time,
-                  dirty ? "true" : "false");
+        uint64_t allowed = QoS::way_mask(this, req.coreid);
 
-            if (!is_last_level) {
-                // not LLC eviction
-                assert(lower_cache != nullptr);
-                lower_cache->evictline(addr, dirty, coreid);
-            } else {
-                // LLC eviction
-                if (dirty) {
-                    Request write_req(addr, Request::Type::WRITE);
-                    cachesys->wait_list.push_back(make_pair(
-                        cachesys->clk + invalidate_time + latency[int(level)],
-                        write_req));
-
-                    debug(
-                        "inject one write request to memory system "
-                        "addr %lx, invalidate time %ld, issue time %ld",
-                        write_req.addr, invalidate_time,
-                        cachesys->clk + invalidate_time + latency[int(level)]);
+        // See if an eviction is needed
+        if (need_eviction<QoS>(lines, addr, req.coreid)) {
+            // Get victim from the replacement policy.
+            // Lines might still be locked due to reorder in MC
+            Line* victim = nullptr;
+            uint64_t candidates = 0;
+            for (unsigned int way = 0; way < assoc; way++) {
+                if (lines[way].valid && !lines[way].lock) {
+                    candidates |= (1ull << way);
                 }
             }
-
-            lines->erase(victim);
-        }
-        // 18-740 QoS: Custom QoS
-        else if (cachesys->cache_qos == CacheSystem::Cache_QoS::custom) {
-            debug("level %d miss evict victim %lx", int(level), victim->addr);
-            cache_eviction++;
-
-            long addr = victim->addr;
-            long invalidate_time = 0;
-            bool dirty = victim->dirty;
-
-            // First invalidate the victim line in higher level.
-            if (higher_cache.size()) {
-                for (auto hc : higher_cache) {
-                    auto result = hc->invalidate(addr, coreid);
-                    invalidate_time =
-                        max(invalidate_time,
-                            result.first +
-                                (result.second ? latency_each[int(level)] : 0));
-                    dirty = dirty || result.second || victim->dirty;
+            candidates &= allowed;
+            while (candidates) {
+                int way = repl->victim(get_set(lines), candidates);
+                bool check = true;
+                if (!is_first_level) {
+                    for (auto hc : higher_cache) {
+                        if (!check) {
+                            break;
+                        }
+                        check = check && hc->check_unlock(lines[way].addr);
+                    }
+                }
+                if (check) {
+                    victim = &lines[way];
+                    break;
                 }
+                candidates &= ~(1ull << way);
             }
+            if (victim == nullptr) {
+                return victim;  // doesn't exist a line that's already
+                                // unlocked in each level
+            }
+            evict(victim, req.coreid);
+        }
 
-            debug("invalidate delay: %ld, dirty: %s", invalidate_time,
-                  dirty ? "true" : "false");
+        // Allocate newline in a free way, with lock bit on and dirty
+        // bit off
+        Line* newline = lines;
+        while (newline->valid || !(allowed >> (newline - lines) & 1)) {
+            newline++;
+        }
+        newline->addr = addr;
+        newline->tag = get_tag(addr);
+        newline->valid = true;
+        newline->lock = true;
+        newline->dirty = false;
+        newline->prefetch = -1;
+        repl->insert(get_set(newline), get_way(newline), req);
+        return newline;
+    }
 
-            if (!is_last_level) {
-                // not LLC eviction
-                assert(lower_cache != nullptr);
-                lower_cache->evictline(addr, dirty, coreid);
-            } else {
-                // LLC eviction
-                if (dirty) {
-                    Request write_req(addr, Request::Type::WRITE);
-                    cachesys->wait_list.push_back(make_pair(
-                        cachesys->clk + invalidate_time + latency[int(level)],
-                        write_req));
-
-                    debug(
-                        "inject one write request to memory system "
-                        "addr %lx, invalidate time %ld, issue time %ld",
-                        write_req.addr, invalidate_time,
-                        cachesys->clk + invalidate_time + latency[int(level)]);
-                }
-            }
+    void Cache::update_way_masks() {
+        std::vector<uint64_t> part_masks(ucp->partitions());
+        int way = 0;
+        for (int part = 0; part < ucp->partitions(); part++) {
+            int ways = ucp->quota[part];
+            part_masks[part] = ((ways == 64 ? 0 : 1ull << ways) - 1) << way;
+            way += ways;
+        }
+        way_masks.resize(cachesys->core_num);
+        for (int core = 0; core < cachesys->core_num; core++) {
+            way_masks[core] = part_masks[ucp->partition(core)];
+        }
+    }
 
-            lines->erase(victim);
-        }
-        // 18-740 QoS: None (baseline cache)
-        else {
-            debug("level %d miss evict victim %lx", int(level), victim->addr);
-            cache_eviction++;
-
-            long addr = victim->addr;
-            long invalidate_time = 0;
-            bool dirty = victim->dirty;
-
-            // First invalidate the victim line in higher level.
-            if (higher_cache.size()) {
-                for (auto hc : higher_cache) {
-                    auto result = hc->invalidate(addr, coreid);
-                    invalidate_time =
-                        max(invalidate_time,
-                            result.first +
-                                (result.second ? latency_each[int(level)] : 0));
-                    dirty = dirty || result.second || victim->dirty;
-                }
-            }
+    template <typename QoS>
+    void Cache::issue_prefetches(int coreid, long addr) {
+        prefetch_candidates.clear();
+        prefetcher->train(coreid, addr, prefetch_candidates);
 
-            debug("invalidate delay: %ld, dirty: %s", invalidate_time,
-                  dirty ? "true" : "false");
+        for (long pf_addr : prefetch_candidates) {
+            // Leave a quarter of the MSHRs to demand misses
+            if (mshr.size() >= mshr_entry_num - mshr_entry_num / 4) break;
 
-            if (!is_last_level) {
-                // not LLC eviction
-                assert(lower_cache != nullptr);
-                lower_cache->evictline(addr, dirty, coreid);
-            } else {
-                // LLC eviction
-                if (dirty) {
-                    Request write_req(addr, Request::Type::WRITE);
-                    cachesys->wait_list.push_back(make_pair(
-                        cachesys->clk + invalidate_time + latency[int(level)],
-                        write_req));
-
-                    debug(
-                        "inject one write request to memory system "
-                        "addr %lx, invalidate time %ld, issue time %ld",
-                        write_req.addr, invalidate_time,
-                        cachesys->clk + invalidate_time + latency[int(level)]);
-                }
+            auto lines = QoS::get_lines(this, pf_addr, coreid);
+            if (find_line(lines, pf_addr) != nullptr ||
+                hit_mshr(pf_addr) != nullptr || all_sets_locked(lines)) {
+                continue;
             }
 
-            lines->erase(victim);
+            Request req(pf_addr, Request::Type::READ,
+                        [this](Request& req) { callback(req); }, coreid);
+            auto newline = allocate_line<QoS>(lines, req);
+            if (newline == nullptr) continue;
+            newline->prefetch = coreid;
+
+            mshr.allocate(pf_addr, newline)->prefetch = true;
+
+            cachesys->prefetch_tags->insert(pf_addr, coreid);
+            cachesys->wait_list.push(cachesys->clk + latency[int(level)],
+                                     std::move(req));
+            prefetches_issued++;
         }
+        update_prefetch_stats();
     }
 
-    // * This function header was modified to pass down core values to other
-    //    functions.
-    std::list<Cache::Line>::iterator Cache::allocate_line(
-        std::list<Line>& lines, Request req) {
-        long addr = req.addr;
+    bool Cache::drop_prefetch(const Request& req) {
+        if (req.type != Request::Type::READ ||
+            !cachesys->prefetch_tags->contains(req.addr)) {
+            return false;
+        }
+        auto entry = hit_mshr(req.addr);
+        assert(entry != nullptr && entry->prefetch && entry->targets.empty());
+
+        // Nothing waits for the line, free it and its MSHR entry
+        Line* line = entry->line;
+        line->valid = false;
+        line->lock = false;
+        line->prefetch = -1;
+        repl->evict(get_set(line), get_way(line));
+
+        mshr.release(entry);
+        cachesys->prefetch_tags->erase(req.addr);
+        prefetches_dropped++;
+        return true;
+    }
 
-        // 18-740 QoS: Way Partitioning
-        if (cachesys->cache_qos == CacheSystem::Cache_QoS::way_partitioning) {
-            // See if an eviction is needed
-            if (need_eviction(lines, addr)) {
-                // Get victim.
-                // The first one might still be locked due to reorder in MC
-                auto victim =
-                    find_if(lines.begin(), lines.end(), [this](Line line) {
-                        bool check = !line.lock;
-                        if (!is_first_level) {
-                            for (auto hc : higher_cache) {
-                                if (!check) {
-                                    return check;
-                                }
-                                check = check && hc->check_unlock(line.addr);
-                            }
-                        }
-                        return check;
-                    });
-                if (victim == lines.end()) {
-                    return victim;  // doesn't exist a line that's already
-                                    // unlocked in each level
-                }
-                assert(victim != lines.end());
-                evict(&lines, victim, req.coreid);
+    void Cache::clean_dirty_lines(const std::vector<long>& addrs,
+                                  size_t max, std::vector<long>& out) {
+        for (long addr : addrs) {
+            if (out.size() >= max) {
+                return;
             }
-
-            // Allocate newline, with lock bit on and dirty bit off
-            lines.push_back(Line(addr, get_tag(addr)));
-            auto last_element = lines.end();
-            --last_element;
-            return last_element;
-        }
-        // 18-740 QoS: Custom QoS
-        else if (cachesys->cache_qos == CacheSystem::Cache_QoS::custom) {
-            // See if an eviction is needed
-            if (need_eviction(lines, addr)) {
-                // Get victim.
-                // The first one might still be locked due to reorder in MC
-                auto victim =
-                    find_if(lines.begin(), lines.end(), [this](Line line) {
-                        bool check = !line.lock;
-                        if (!is_first_level) {
-                            for (auto hc : higher_cache) {
-                                if (!check) {
-                                    return check;
-                                }
-                                check = check && hc->check_unlock(line.addr);
-                            }
-                        }
-                        return check;
-                    });
-                if (victim == lines.end()) {
-                    return victim;  // doesn't exist a line that's already
-                                    // unlocked in each level
-                }
-                assert(victim != lines.end());
-                evict(&lines, victim, req.coreid);
-            }
-
-            // Allocate newline, with lock bit on and dirty bit off
-            lines.push_back(Line(addr, get_tag(addr)));
-            auto last_element = lines.end();
-            --last_element;
-            return last_element;
-        }
-        // 18-740 QoS: None (baseline cache)
-        else {
-            // See if an eviction is needed
-            if (need_eviction(lines, addr)) {
-                // Get victim.
-                // The first one might still be locked due to reorder in MC
-                auto victim =
-                    find_if(lines.begin(), lines.end(), [this](Line line) {
-                        bool check = !line.lock;
-                        if (!is_first_level) {
-                            for (auto hc : higher_cache) {
-                                if (!check) {
-                                    return check;
-                                }
-                                check = check && hc->check_unlock(line.addr);
-                            }
-                        }
-                        return check;
-                    });
-                if (victim == lines.end()) {
-                    return victim;  // doesn't exist a line that's already
-                                    // unlocked in each level
-                }
-                assert(victim != lines.end());
-                evict(&lines, victim, req.coreid);
+            // A locked line waits for its fill, the data is not here yet
+            Line* line = find_line(get_lines(addr), addr);
+            if (line == nullptr || !line->dirty || line->lock) {
+                continue;
             }
+            line->dirty = false;
+            out.push_back(addr);
+            cache_early_writeback++;
+        }
+    }
 
-            // Allocate newline, with lock bit on and dirty bit off
-            lines.push_back(Line(addr, get_tag(addr)));
-            auto last_element = lines.end();
-            --last_element;
-            return last_element;
+    void Cache::update_prefetch_stats() {
+        double useful = prefetches_useful.value();
+        double late = prefetches_late.value();
+        if (prefetches_issued.value() > 0) {
+            prefetch_accuracy = useful / prefetches_issued.value();
+        }
+        // Late prefetches were counted as demand misses as well
+        double misses = useful + cache_total_miss.value() - late;
+        if (misses > 0) {
+            prefetch_coverage = useful / misses;
+        }
+        if (useful > 0) {
+            prefetch_lateness = late / useful;
         }
     }
 
-    bool Cache::is_hit(std::list<Line>& lines, long addr,
-                       std::list<Line>::iterator* pos_ptr) {
-        auto pos = find_if(lines.begin(), lines.end(), [addr, this](Line l) {
-            return (l.tag == get_tag(addr));
-        });
+    bool Cache::is_hit(Line* lines, long addr, Line** pos_ptr) {
+        auto pos = find_line(lines, addr);
         *pos_ptr = pos;
-        if (pos == lines.end()) {
+        if (pos == nullptr) {
             return false;
         }
         return !pos->lock;
@@ -839,55 +653,54 @@ namespace ramulator {
         lower->higher_cache.push_back(this);
     };
 
-    bool Cache::need_eviction(const std::list<Line>& lines, long addr) {
-        // * For our configuration, due to the LRU structure of the given
-        //   code, we are cutting down the associativity PER CORE to 2, and
-        //   subsequently increasing the cache multiples of "ways" to 4.
-        //   This gives us two ways per core, and 4 cores per cache, to a
-        //   total of 8 groups.
-        if (cachesys->cache_qos == CacheSystem::Cache_QoS::way_partitioning) {
-            if (find_if(lines.begin(), lines.end(), [addr, this](Line l) {
-                    return (get_tag(addr) == l.tag);
-                }) != lines.end()) {
-                // Due to MSHR, the program can't reach here. Just for checking
-                assert(false);
-            } else {
-                // * For waypart, limiting the size to 2 as a strict count
-                if (lines.size() < 2) {
-                    return false;
-                } else {
-                    return true;
-                }
-            }
-        } else {
-            if (find_if(lines.begin(), lines.end(), [addr, this](Line l) {
-                    return (get_tag(addr) == l.tag);
-                }) != lines.end()) {
-                // Due to MSHR, the program can't reach here. Just for checking
-                assert(false);
-            } else {
-                if (lines.size() < assoc) {
-                    return false;
-                } else {
-                    return true;
-                }
+    template <typename QoS>
+    bool Cache::need_eviction(Line* lines, long addr, int coreid) {
+        if (find_line(lines, addr) != nullptr) {
+            // Due to MSHR, the program can't reach here. Just for checking
+            assert(false);
+        }
+        uint64_t allowed = QoS::way_mask(this, coreid);
+        for (unsigned int way = 0; way < assoc; way++) {
+            if ((allowed >> way & 1) && !lines[way].valid) {
+                return false;
             }
         }
+        return true;
+    }
+
+    void Cache::update_mshr_occupancy() {
+        cache_mshr_occupancy_sum += mshr.size();
+        cache_mshr_occupancy_avg =
+            cache_mshr_occupancy_sum.value() / cachesys->clk;
+        if (mshr.size() > cache_mshr_occupancy_max.value()) {
+            cache_mshr_occupancy_max = mshr.size();
+        }
     }
 
     void Cache::callback(Request& req) {
         debug("level %d", int(level));
 
-        auto it =
-            find_if(mshr_entries.begin(), mshr_entries.end(),
-                    [&req, this](
-                        std::pair<long, std::list<Line>::iterator> mshr_entry) {
-                        return (align(mshr_entry.first) == align(req.addr));
-                    });
+        // Requests merged into the entry, completed after the fill has
+        // reached every level
+        std::vector<Request> targets;
+
+        auto entry = hit_mshr(req.addr);
+        if (entry != nullptr) {
+            entry->line->lock = false;
+            targets.swap(entry->targets);
+            if (entry->prefetch) {
+                cachesys->prefetch_tags->erase(entry->addr);
+            }
+
+            mshr.release(entry);
 
-        if (it != mshr_entries.end()) {
-            it->second->lock = false;
-            mshr_entries.erase(it);
+            cache_mshr_retired++;
+            if (targets.size() > cache_mshr_merge_depth_max.value()) {
+                cache_mshr_merge_depth_max = targets.size();
+            }
+            mshr_merged_retired += targets.size();
+            cache_mshr_merge_depth_avg =
+                double(mshr_merged_retired) / cache_mshr_retired.value();
         }
 
         if (higher_cache.size()) {
@@ -895,13 +708,28 @@ namespace ramulator {
                 hc->callback(req);
             }
         }
+
+        // A target's callback is the full processor receive, which comes
+        // back here with the MSHR entries of the block already released
+        // at every level, and readies the block in the windows of all
+        // cores again. Both only repeat what the fill did, and the core
+        // leaves the target out of its memory latency since it never
+        // arrived at memory (arrive is -1).
+        for (auto& target : targets) {
+            debug("finish merged: addr %lx", target.addr);
+            target.callback(target);
+        }
     }
 
     void Cache::tick() {
         if (!lower_cache->is_last_level) lower_cache->tick();
 
-        for (auto it = retry_list.begin(); it != retry_list.end(); it++) {
-            if (lower_cache->send(*it)) it = retry_list.erase(it);
+        for (auto it = retry_list.begin(); it != retry_list.end();) {
+            if (lower_cache->send(*it)) {
+                it = retry_list.erase(it);
+            } else {
+                ++it;
+            }
         }
     }
 
@@ -909,32 +737,29 @@ namespace ramulator {
         debug("clk %ld", clk);
 
         ++clk;
+        if (series) series->sample(clk);
+        for (Cache* cache : caches) {
+            cache->update_mshr_occupancy();
+        }
 
         // Sends ready waiting request to memory
-        auto it = wait_list.begin();
-        while (it != wait_list.end() && clk >= it->first) {
-            if (!send_memory(it->second)) {
-                ++it;
-            } else {
-                debug("complete req: addr %lx", (it->second).addr);
-
-                it = wait_list.erase(it);
+        wait_list.advance(clk);
+        wait_list.pop_ready([this](Request& req) {
+            if (!send_memory(req)) {
+                // A prefetch the memory has no room for is dropped
+                return llc != nullptr && llc->drop_prefetch(req);
             }
-        }
+            debug("complete req: addr %lx", req.addr);
+            return true;
+        });
 
         // hit request callback
-        it = hit_list.begin();
-        while (it != hit_list.end()) {
-            if (clk >= it->first) {
-                it->second.callback(it->second);
-
-                debug("finish hit: addr %lx", (it->second).addr);
-
-                it = hit_list.erase(it);
-            } else {
-                ++it;
-            }
-        }
+        hit_list.advance(clk);
+        hit_list.pop_ready([](Request& req) {
+            req.callback(req);
+            debug("finish hit: addr %lx", req.addr);
+            return true;
+        });
     }
 
 }  // namespace ramulator
\ No newline at end of file
@@ -2,10 +2,17 @@
 #define __CACHE_H
 
 #include "Config.h"
+#include "EventQueue.h"
+#include "Prefetcher.h"
+#include "ReplacementPolicy.h"
 #include "Request.h"
 #include "Statistics.h"
+#include "TimeSeries.h"
+#include "UCP.h"
+#include "WritebackLink.h"
 #include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 #include <cassert>
 #include <functional>
 #include <list>
@@ -13,6 +20,7 @@
 #include <memory>
 #include <queue>
 #include <list>
+#include <unordered_map>
 
 namespace ramulator {
     class CacheSystem;
@@ -28,21 +36,45 @@ namespace ramulator {
         ScalarStat cache_total_access;
         ScalarStat cache_mshr_hit;
         ScalarStat cache_mshr_unavailable;
+        ScalarStat cache_mshr_occupancy_sum;
+        ScalarStat cache_mshr_occupancy_avg;
+        ScalarStat cache_mshr_occupancy_max;
+        ScalarStat cache_mshr_merge_depth_avg;
+        ScalarStat cache_mshr_merge_depth_max;
+        ScalarStat cache_mshr_retired;
         ScalarStat cache_set_unavailable;
+        VectorStat cache_way_quota;
+        ScalarStat prefetches_issued;
+        ScalarStat prefetches_useful;
+        ScalarStat prefetches_late;
+        ScalarStat prefetches_dropped;
+        ScalarStat prefetch_accuracy;
+        ScalarStat prefetch_coverage;
+        ScalarStat prefetch_lateness;
+        ScalarStat cache_early_writeback;
 
     public:
         enum class Level { L1, L2, L3, MAX } level;
         std::string level_string;
 
+        // One way of a set. All ways of all sets live in one contiguous
+        // array, so a set is addressed by a pointer to its first way.
         struct Line {
             long addr;
             long tag;
-            bool lock;  // When the lock is on, the value is not valid yet.
+            bool valid;  // When the valid bit is off, the way is free.
+            bool lock;   // When the lock is on, the value is not valid yet.
             bool dirty;
-            Line(long addr, long tag)
-                : addr(addr), tag(tag), lock(true), dirty(false) {}
-            Line(long addr, long tag, bool lock, bool dirty)
-                : addr(addr), tag(tag), lock(lock), dirty(dirty) {}
+            // Core whose prefetch brought the line in, -1 once the line
+            // is used or if no prefetch did
+            int prefetch;
+            Line()
+                : addr(0),
+                  tag(0),
+                  valid(false),
+                  lock(false),
+                  dirty(false),
+                  prefetch(-1) {}
         };
 
         Cache(int size, int assoc, int block_size, int mshr_entry_num,
@@ -59,13 +91,88 @@ namespace ramulator {
         std::vector<Cache*> higher_cache;
         Cache* lower_cache;
 
-        bool send(Request req);
+        bool send(Request req) { return (this->*send_fn)(std::move(req)); }
 
         void concatlower(Cache* lower);
 
         void callback(Request& req);
 
+        // Add the MSHR occupancy of this cycle to the stats, called by
+        // CacheSystem::tick() so that every cycle counts
+        void update_mshr_occupancy();
+
+        // Change the ways core may allocate in under way partitioning. With
+        // UCP the masks are recomputed at the end of the epoch.
+        void set_way_mask(int core, uint64_t mask) {
+            assert(unsigned(core) < way_masks.size());
+            assert(mask && (mask & ~all_ways) == 0);
+            way_masks[core] = mask;
+            cache_way_quota[core] = __builtin_popcountll(mask);
+        }
+
+        // Called when memory turns req down or drops it from a queue. An
+        // unused prefetch is given up, returns whether req was one.
+        bool drop_prefetch(const Request& req);
+
+        // Mark clean at most max of the dirty, unlocked lines among addrs
+        // and append their addresses to out, for the memory controllers to
+        // write back (see WritebackLink)
+        void clean_dirty_lines(const std::vector<long>& addrs, size_t max,
+                               std::vector<long>& out);
+
     protected:
+        // 18-740 QoS modes. The cache core below is templated on the mode,
+        // which decides where the set of an address lives and the ways of
+        // it that a core may allocate lines in. Lookups hit in any way.
+        struct BasicQoS {
+            static Line* get_lines(Cache* cache, long addr, int coreid) {
+                return cache->get_lines(addr);
+            }
+            static uint64_t way_mask(Cache* cache, int coreid) {
+                return cache->all_ways;
+            }
+        };
+
+        // * Way partitioning at the last level gives every core a mask of
+        //   the ways it may fill and evict in the shared sets. The masks
+        //   are the config's way_masks, or else come from UCP: contiguous
+        //   ways in the number of the quota of the core's partition (the
+        //   core itself, unless there are more cores than ways), starting
+        //   from an equal share and recomputed every ucp_epoch cycles from
+        //   what the partitions would gain from more ways. Lines left
+        //   outside a new mask stay readable until the mask's owner
+        //   replaces them, so masks change without a flush. The private
+        //   levels have one core and are not partitioned.
+        struct WayPartitioningQoS : BasicQoS {
+            static uint64_t way_mask(Cache* cache, int coreid) {
+                if (cache->way_masks.empty()) {
+                    return cache->all_ways;
+                }
+                assert(unsigned(coreid) < cache->way_masks.size());
+                return cache->way_masks[coreid];
+            }
+        };
+
+        struct CustomQoS : BasicQoS {};
+
+        // Entry points of the core instantiated for cachesys->cache_qos,
+        // bound once at construction
+        bool (Cache::*send_fn)(Request req);
+        void (Cache::*evictline_fn)(long addr, bool dirty, int coreid);
+        std::pair<long, bool> (Cache::*invalidate_fn)(long addr, int coreid);
+
+        template <typename QoS>
+        void bind_qos();
+
+        template <typename QoS>
+        bool do_send(Request req);
+
+        template <typename QoS>
+        void do_evictline(long addr, bool dirty, int coreid);
+
+        template <typename QoS>
+        std::pair<long, bool> do_invalidate(long addr, int coreid);
+
         bool is_first_level;
         bool is_last_level;
         size_t size;
@@ -76,12 +183,91 @@ namespace ramulator {
         unsigned int index_offset;
         unsigned int tag_offset;
         unsigned int mshr_entry_num;
-        std::vector<std::pair<long, std::list<Line>::iterator>> mshr_entries;
         std::list<Request> retry_list;
 
-        std::map<int, std::list<Line>> cache_lines;
+        // Miss status holding registers. Entries live in fixed slots and
+        // are found by block address through a hash index. Requests that
+        // miss on a block already in flight are merged into its entry as
+        // targets and get their own callback when the fill arrives.
+        class MSHR {
+        public:
+            struct Entry {
+                long addr;  // block address
+                Line* line;  // line waiting for the fill
+                std::vector<Request> targets;  // merged requests
+                bool prefetch;  // no demand request waits for the fill
+            };
+
+            explicit MSHR(unsigned int entry_num) : slots(entry_num) {
+                free_slots.reserve(entry_num);
+                for (unsigned int i = entry_num; i > 0; i--) {
+                    free_slots.push_back(i - 1);
+                }
+                index.reserve(entry_num * 2);
+            }
+
+            size_t size() const { return index.size(); }
+            bool full() const { return free_slots.empty(); }
+
+            Entry* find(long addr) {
+                auto it = index.find(addr);
+                return it == index.end() ? nullptr : &slots[it->second];
+            }
+
+            Entry* allocate(long addr, Line* line) {
+                assert(!full() && find(addr) == nullptr);
+                int slot = free_slots.back();
+                free_slots.pop_back();
+                index[addr] = slot;
+                Entry& entry = slots[slot];
+                entry.addr = addr;
+                entry.line = line;
+                entry.targets.clear();
+                entry.prefetch = false;
+                return &entry;
+            }
+
+            void release(Entry* entry) {
+                free_slots.push_back(int(entry - slots.data()));
+                index.erase(entry->addr);
+            }
+
+        private:
+            std::vector<Entry> slots;
+            std::vector<int> free_slots;
+            std::unordered_map<long, int> index;
+        };
+
+        MSHR mshr;
+        // Requests merged into the retired MSHR entries
+        long mshr_merged_retired = 0;
+
+        // Tag store: block_num sets of assoc ways each, allocated once at
+        // construction
+        std::vector<Line> cache_lines;
+
+        uint64_t all_ways;
+        // Ways each core may allocate in, for way partitioning at the last
+        // level, and the monitor that sizes them unless the config does
+        std::vector<uint64_t> way_masks;
+        std::unique_ptr<UCP> ucp;
+
+        // Lay the UCP quotas out as contiguous masks, one per partition
+        void update_way_masks();
 
-        std::map<int, std::list<Line>> cache_lines_wp[4];
+        // Prefetch engine of the L3, and its candidates for an access
+        std::unique_ptr<Prefetcher> prefetcher;
+        std::vector<long> prefetch_candidates;
+
+        // Train the prefetcher on an access of coreid to addr and issue
+        // the prefetches that find a spare MSHR and a line to fill
+        template <typename QoS>
+        void issue_prefetches(int coreid, long addr);
+
+        void update_prefetch_stats();
+
+        // Recency metadata and victim selection of the tag store
+        std::unique_ptr<ReplacementPolicy> repl;
 
         int calc_log2(int val) {
             int n = 0;
@@ -100,41 +286,70 @@ namespace ramulator {
 
         // Evict the cache line from higher level to this level.
         // Pass the dirty bit and update LRU queue.
-        void evictline(long addr, bool dirty, int coreid);
+        void evictline(long addr, bool dirty, int coreid) {
+            (this->*evictline_fn)(addr, dirty, coreid);
+        }
 
         // Invalidate the line from this level to higher levels
         // The return value is a pair. The first element is invalidation
         // latency, and the second is wether the value has new version
         // in higher level and this level.
-        std::pair<long, bool> invalidate(long addr, int coreid);
+        std::pair<long, bool> invalidate(long addr, int coreid) {
+            return (this->*invalidate_fn)(addr, coreid);
+        }
 
         // Evict the victim from current set of lines.
         // First do invalidation, then call evictline(L1 or L2) or send
         // a write request to memory(L3) when dirty bit is on.
-        void evict(std::list<Line>* lines, std::list<Line>::iterator victim,
-                   int coreid);
+        void evict(Line* victim, int coreid);
 
         // First test whether need eviction, if so, do eviction by
         // calling evict function. Then allocate a new line and return
-        // the iterator points to it.
-        std::list<Line>::iterator allocate_line(std::list<Line>& lines,
-                                                Request req);
+        // the pointer to it, or nullptr when no way can be freed.
+        template <typename QoS>
+        Line* allocate_line(Line* lines, const Request& req);
 
-        // Check whether the set to hold addr has space or eviction is
-        // needed.
-        bool need_eviction(const std::list<Line>& lines, long addr);
+        // Check whether the ways of the set that coreid may allocate in
+        // have space or eviction is needed.
+        template <typename QoS>
+        bool need_eviction(Line* lines, long addr, int coreid);
 
         // Check whether this addr is hit and fill in the pos_ptr with
-        // the iterator to the hit line or lines.end()
-        bool is_hit(std::list<Line>& lines, long addr,
-                    std::list<Line>::iterator* pos_ptr);
+        // the pointer to the hit line or nullptr
+        bool is_hit(Line* lines, long addr, Line** pos_ptr);
+
+        // Find the valid way holding addr in the set, or nullptr
+        Line* find_line(Line* lines, long addr) {
+            long tag = get_tag(addr);
+            for (unsigned int way = 0; way < assoc; way++) {
+                if (lines[way].valid && lines[way].tag == tag) {
+                    return &lines[way];
+                }
+            }
+            return nullptr;
+        }
 
-        bool all_sets_locked(const std::list<Line>& lines) {
-            if (lines.size() < assoc) {
-                return false;
+        // Number of ways holding a line in the set
+        unsigned int valid_lines(const Line* lines) {
+            unsigned int n = 0;
+            for (unsigned int way = 0; way < assoc; way++) {
+                n += lines[way].valid;
             }
-            for (const auto& line : lines) {
-                if (!line.lock) {
+            return n;
+        }
+
+        // Set and way of a line in the tag store
+        int get_set(const Line* line) {
+            return int((line - cache_lines.data()) / assoc);
+        }
+
+        int get_way(const Line* line) {
+            return int((line - cache_lines.data()) % assoc);
+        }
+
+        bool all_sets_locked(const Line* lines) {
+            for (unsigned int way = 0; way < assoc; way++) {
+                if (!lines[way].valid || !lines[way].lock) {
                     return false;
                 }
             }
@@ -142,57 +357,26 @@ namespace ramulator {
         }
 
         bool check_unlock(long addr) {
-            auto it = cache_lines.find(get_index(addr));
-            if (it == cache_lines.end()) {
+            Line* line = find_line(get_lines(addr), addr);
+            if (line == nullptr) {
                 return true;
-            } else {
-                auto& lines = it->second;
-                auto line = find_if(
-                    lines.begin(), lines.end(),
-                    [addr, this](Line l) { return (l.tag == get_tag(addr)); });
-                if (line == lines.end()) {
-                    return true;
-                } else {
-                    bool check = !line->lock;
-                    if (!is_first_level) {
-                        for (auto hc : higher_cache) {
-                            if (!check) {
-                                return check;
-                            }
-                            check = check && hc->check_unlock(line->addr);
-                        }
+            }
+            bool check = !line->lock;
+            if (!is_first_level) {
+                for (auto hc : higher_cache) {
+                    if (!check) {
+                        return check;
                     }
-                    return check;
+                    check = check && hc->check_unlock(line->addr);
                 }
             }
+            return check;
         }
 
-        std::vector<std::pair<long, std::list<Line>::iterator>>::iterator
-        hit_mshr(long addr) {
-            auto mshr_it = find_if(
-                mshr_entries.begin(), mshr_entries.end(),
-                [addr,
-                 this](std::pair<long, std::list<Line>::iterator> mshr_entry) {
-                    return (align(mshr_entry.first) == align(addr));
-                });
-            return mshr_it;
-        }
+        MSHR::Entry* hit_mshr(long addr) { return mshr.find(align(addr)); }
 
-        std::list<Line>& get_lines(long addr) {
-            if (cache_lines.find(get_index(addr)) == cache_lines.end()) {
-                cache_lines.insert(
-                    make_pair(get_index(addr), std::list<Line>()));
-            }
-            return cache_lines[get_index(addr)];
-        }
-
-        std::list<Line>& get_lines_waypart(long addr, int coreid) {
-            if (cache_lines_wp[coreid].find(get_index(addr)) ==
-                cache_lines_wp[coreid].end()) {
-                cache_lines_wp[coreid].insert(
-                    make_pair(get_index(addr), std::list<Line>()));
-            }
-            return cache_lines_wp[coreid][get_index(addr)];
+        Line* get_lines(long addr) {
+            return &cache_lines[size_t(get_index(addr)) * assoc];
         }
     };
 
@@ -200,7 +384,11 @@ namespace ramulator {
     public:
         CacheSystem(const Config& configs,
                     std::function<bool(Request)> send_memory)
-            : send_memory(send_memory) {
+            : send_memory(send_memory),
+              prefetch_tags(PrefetchTags::get(configs)),
+              writeback_link(WritebackLink::get(configs)),
+              core_num(configs.get_core_num()),
+              series(TimeSeries::create(configs, "cache")) {
             if (configs.has_core_caches()) {
                 first_level = Cache::Level::L1;
             } else if (configs.has_l3_cache()) {
@@ -225,23 +413,97 @@ namespace ramulator {
             } else {
                 cache_qos = Cache_QoS::basic;
             }
+
+            if (configs.contains("ucp_epoch")) {
+                ucp_epoch = std::stol(configs["ucp_epoch"]);
+            }
+            if (configs.contains("prefetcher")) {
+                auto it = Prefetcher::name_to_type.find(configs["prefetcher"]);
+                if (it == Prefetcher::name_to_type.end()) {
+                    fprintf(stderr, "Unknown prefetcher: %s\n",
+                            configs["prefetcher"].c_str());
+                    exit(1);
+                }
+                prefetcher = it->second;
+            }
+            if (configs.contains("prefetch_degree")) {
+                prefetch_degree = std::stoi(configs["prefetch_degree"]);
+            }
+
+            if (configs.contains("way_masks")) {
+                // comma separated, in hex, one per core
+                std::string masks = configs["way_masks"];
+                size_t pos = 0;
+                while (pos < masks.size()) {
+                    size_t end = masks.find(',', pos);
+                    if (end == std::string::npos) end = masks.size();
+                    way_masks.push_back(std::stoull(
+                        masks.substr(pos, end - pos), nullptr, 16));
+                    pos = end + 1;
+                }
+                // A core without ways would find no line to fill
+                if (int(way_masks.size()) != core_num ||
+                    std::count(way_masks.begin(), way_masks.end(), 0)) {
+                    fprintf(stderr,
+                            "way_masks needs a nonzero mask per core: %s\n",
+                            masks.c_str());
+                    exit(1);
+                }
+            }
+
+            if (configs.contains("cache_replacement")) {
+                auto it = ReplacementPolicy::name_to_policy.find(
+                    configs["cache_replacement"]);
+                if (it == ReplacementPolicy::name_to_policy.end()) {
+                    fprintf(stderr, "Unknown cache_replacement: %s\n",
+                            configs["cache_replacement"].c_str());
+                    exit(1);
+                }
+                replacement = it->second;
+            }
         }
 
         // 18-740
         enum class Cache_QoS { basic, way_partitioning, custom } cache_qos;
 
-        // wait_list contains miss requests with their latencies in
-        // cache. When this latency is met, the send_memory function
-        // will be called to send the request to the memory system.
-        std::list<std::pair<long, Request>> wait_list;
+        // Replacement policy of the last level cache
+        ReplacementPolicy::Type replacement = ReplacementPolicy::Type::LRU;
+
+        // Cycles between UCP repartitions under way partitioning, and the
+        // fixed way masks of the cores that replace UCP if given
+        long ucp_epoch = 5000000;
+        std::vector<uint64_t> way_masks;
 
-        // hit_list contains hit requests with their latencies in cache.
-        // callback function will be called when this latency is met and
+        // wait_list contains miss requests keyed on the cycle their
+        // latency in cache is met. From then on the send_memory function
+        // will be called to send the request to the memory system, in
+        // order, until it is accepted.
+        EventQueue<Request> wait_list;
+
+        // hit_list contains hit requests keyed on the cycle their latency
+        // in cache is met. Then the callback function will be called and
         // set the instruction status to ready in processor's window.
-        std::list<std::pair<long, Request>> hit_list;
+        EventQueue<Request> hit_list;
 
         std::function<bool(Request)> send_memory;
 
+        // Prefetching at the L3, and the prefetches it has in flight
+        Prefetcher::Type prefetcher = Prefetcher::Type::None;
+        int prefetch_degree = 2;
+        std::shared_ptr<PrefetchTags> prefetch_tags;
+        Cache* llc = nullptr;  // set by the L3 if it prefetches
+
+        // Lets the memory controllers write back dirty lines of the L3
+        std::shared_ptr<WritebackLink> writeback_link;
+
+        int core_num;
+
+        // Caches of every level, for their per-cycle stats
+        std::vector<Cache*> caches;
+
+        // LLC counters sampled every stats_interval cycles, if set
+        std::unique_ptr<TimeSeries> series;
+
         long clk = 0;
         void tick();
 
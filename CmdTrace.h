@@ -0,0 +1,205 @@
+#ifndef __CMDTRACE_H
+#define __CMDTRACE_H
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ramulator {
+
+    // Command trace of a channel for DRAMPower, one file per rank. The
+    // controller only puts a small record into a ring buffer for each
+    // command it issues; a background thread formats the records and
+    // writes them out in large chunks.
+    //
+    // Formats (config cmd_trace_format):
+    //   text   - "<clk>,<command>[,<bank>]" lines, as read by DRAMPower
+    //            (default). Rank-wide commands (PREA, REF) have no bank.
+    //   binary - "RAMCMDTR", the number of commands and their names (each
+    //            a length byte and the characters), then one Record per
+    //            command in host byte order.
+    class CmdTrace {
+    public:
+        struct Record {
+            int64_t clk;
+            int32_t bank;
+            int16_t rank;
+            int16_t cmd;
+        };
+
+        CmdTrace(const std::string& prefix, int ranks,
+                 const std::vector<std::string>& command_names, bool binary)
+            : binary(binary),
+              files(ranks),
+              buffers(ranks),
+              ring(ring_size) {
+            std::string suffix = binary ? ".cmdtrace.bin" : ".cmdtrace";
+            for (int i = 0; i < ranks; i++)
+                files[i].open(prefix + std::to_string(i) + suffix,
+                              std::ios::binary);
+
+            for (auto& name : command_names) {
+                cmd_text.push_back("," + name);
+                rank_wide.push_back(name == "PREA" || name == "REF");
+            }
+
+            if (binary) {
+                std::string header = "RAMCMDTR";
+                uint32_t num = command_names.size();
+                header.append((const char*)&num, sizeof(num));
+                for (auto& name : command_names) {
+                    assert(name.size() < 256);
+                    header.push_back(char(name.size()));
+                    header += name;
+                }
+                for (auto& file : files) file << header;
+            }
+
+            writer = std::thread(&CmdTrace::run, this);
+        }
+
+        ~CmdTrace() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            wake.notify_one();
+            writer.join();
+        }
+
+        // Called by the controller for every command it issues
+        void record(long clk, int rank, int cmd, int bank) {
+            size_t head = this->head.load(std::memory_order_relaxed);
+            // full: wait for the writer to catch up
+            if (head - tail.load(std::memory_order_acquire) == ring_size) {
+                signal();
+                while (head - tail.load(std::memory_order_acquire) ==
+                       ring_size)
+                    std::this_thread::yield();
+            }
+            ring[head & (ring_size - 1)] = {clk, bank, int16_t(rank),
+                                            int16_t(cmd)};
+            this->head.store(head + 1, std::memory_order_release);
+            if (head + 1 - tail.load(std::memory_order_acquire) ==
+                wake_records)
+                signal();
+        }
+
+        // Write out every command recorded so far
+        void flush() {
+            std::unique_lock<std::mutex> lock(mutex);
+            long seq = ++flush_seq;
+            wake.notify_one();
+            flushed.wait(lock, [this, seq] { return flushed_seq >= seq; });
+        }
+
+    private:
+        static const size_t ring_size = 1 << 16;  // records, a power of two
+        static const size_t chunk_size = 1 << 16;  // bytes per file write
+        // records that wake the writer, which sleeps until then
+        static const size_t wake_records = ring_size / 4;
+
+        bool binary;
+        std::vector<std::ofstream> files;
+        std::vector<std::string> buffers;  // per rank, owned by writer
+        std::vector<std::string> cmd_text;  // "," + command name
+        std::vector<bool> rank_wide;
+
+        std::vector<Record> ring;
+        std::atomic<size_t> head{0};  // next record to fill
+        std::atomic<size_t> tail{0};  // next record to write out
+
+        std::thread writer;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable flushed;
+        bool stop = false;
+        long flush_seq = 0;
+        long flushed_seq = 0;
+
+        void run() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                size_t head = this->head.load(std::memory_order_acquire);
+                size_t tail = this->tail.load(std::memory_order_relaxed);
+                if (tail != head) {
+                    lock.unlock();
+                    for (; tail != head; tail++)
+                        format(ring[tail & (ring_size - 1)]);
+                    this->tail.store(tail, std::memory_order_release);
+                    lock.lock();
+                    continue;
+                }
+
+                if (flushed_seq != flush_seq || stop) {
+                    for (size_t i = 0; i < files.size(); i++) {
+                        write_out(i);
+                        files[i].flush();
+                    }
+                    flushed_seq = flush_seq;
+                    flushed.notify_all();
+                    if (stop) break;
+                }
+                wake.wait(lock, [this] {
+                    size_t queued =
+                        this->head.load(std::memory_order_acquire) -
+                        this->tail.load(std::memory_order_relaxed);
+                    return queued >= wake_records ||
+                           flushed_seq != flush_seq || stop;
+                });
+            }
+        }
+
+        // Wake the writer. Taking the mutex first orders the notify after
+        // the writer's check of the ring, or after its wait begins, so
+        // the wakeup is not lost.
+        void signal() {
+            { std::lock_guard<std::mutex> lock(mutex); }
+            wake.notify_one();
+        }
+
+        void format(const Record& record) {
+            std::string& out = buffers[record.rank];
+            if (binary) {
+                out.append((const char*)&record, sizeof(record));
+            } else {
+                append_int(out, record.clk);
+                out += cmd_text[record.cmd];
+                if (!rank_wide[record.cmd]) {
+                    out.push_back(',');
+                    append_int(out, record.bank);
+                }
+                out.push_back('\n');
+            }
+            if (out.size() >= chunk_size) write_out(record.rank);
+        }
+
+        void write_out(int rank) {
+            std::string& out = buffers[rank];
+            files[rank].write(out.data(), out.size());
+            out.clear();
+        }
+
+        static void append_int(std::string& out, long value) {
+            char digits[24];
+            int n = 0;
+            bool negative = value < 0;
+            unsigned long v = negative ? -(unsigned long)value : value;
+            do {
+                digits[n++] = '0' + v % 10;
+                v /= 10;
+            } while (v);
+            if (negative) out.push_back('-');
+            while (n) out.push_back(digits[--n]);
+        }
+    };
+
+}  // namespace ramulator
+
+#endif /* __CMDTRACE_H */
@@ -1,20 +1,32 @@
 #ifndef __CONTROLLER_H
 #define __CONTROLLER_H
 
+#include <algorithm>
 #include <cassert>
+#include <climits>
 #include <cstdio>
+#include <cstdlib>
 #include <deque>
 #include <fstream>
 #include <list>
+#include <memory>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "Blacklist.h"
+#include "Prefetcher.h"
+#include "CmdTrace.h"
 #include "Config.h"
 #include "DRAM.h"
 #include "Refresh.h"
 #include "Request.h"
 #include "Scheduler.h"
 #include "Statistics.h"
+#include "TimeSeries.h"
+#include "WritebackLink.h"
 
 #include "ALDRAM.h"
 #include "SALP.h"
@@ -26,6 +38,54 @@ namespace ramulator {
 
     extern bool warmup_complete;
 
+    // Read requests waiting for their data, kept as a min-heap on depart
+    // (then on the order they were pushed). top() is always the read that
+    // departs first, wherever it was pushed, and pop_front() removes it.
+    class PendingQueue {
+    public:
+        size_t size() const { return heap.size(); }
+        bool empty() const { return heap.empty(); }
+
+        Request& top() { return heap[0].req; }
+
+        // Only for the TLDRAM tick in Controller.cpp, which is not part of
+        // this tree and still reads pending[0]. Use top().
+        Request& operator[](size_t i) {
+            assert(i == 0);  // only the top is ordered
+            return top();
+        }
+
+        void push_back(const Request& req) {
+            heap.push_back({req, seq++});
+            push_heap(heap.begin(), heap.end(), later);
+        }
+
+        void push_back(Request&& req) {
+            heap.push_back({move(req), seq++});
+            push_heap(heap.begin(), heap.end(), later);
+        }
+
+        void pop_front() {
+            pop_heap(heap.begin(), heap.end(), later);
+            heap.pop_back();
+        }
+
+    private:
+        struct Item {
+            Request req;
+            long seq;
+        };
+
+        static bool later(const Item& a, const Item& b) {
+            if (a.req.depart != b.req.depart)
+                return a.req.depart > b.req.depart;
+            return a.seq > b.seq;
+        }
+
+        vector<Item> heap;
+        long seq = 0;
+    };
+
     template <typename T>
     class Controller {
     protected:
@@ -43,6 +103,18 @@ namespace ramulator {
         VectorStat write_row_misses;
         VectorStat write_row_conflicts;
         ScalarStat useless_activates;
+        ScalarStat forwarded_reads;
+        ScalarStat merged_writes;
+        ScalarStat write_drains;
+        ScalarStat write_drain_length_sum;
+        ScalarStat write_drain_length_avg;
+        ScalarStat write_drain_length_max;
+        ScalarStat read_to_write_turnarounds;
+        ScalarStat write_to_read_turnarounds;
+        ScalarStat prefetch_reads;
+        ScalarStat dropped_prefetches;
+        ScalarStat stale_prefetches;
+        ScalarStat early_writebacks;
 
         ScalarStat read_latency_avg;
         ScalarStat read_latency_sum;
@@ -68,19 +140,27 @@ namespace ramulator {
         long clk = 0;
         DRAM<T>* channel;
 
-        // * BLISS variables
-        int lastCoreID = 0;    // Used to track the core ID of the last request
-        long numRequests = 0;  // Number of requests served from an application
-        // Used to track the blacklist status of the cores (we only have 4)
-        bool bStatus[4] = {false, false, false, false};
+        int core_num;
+
+        // * BLISS variables, shared with the other channels
+        shared_ptr<Blacklist> blacklist;
 
         // * Equity variables
         // Number of requests per core
-        long numRequestsPerCore[4] = {0, 0, 0, 0};
+        vector<long> numRequestsPerCore;
 
         // * Other scheduling variables
-        // Priority settings for each core
-        int priority[4] = {1, 4, 2, 1};
+        // Priority settings for each core, {1, 4, 2, 1} for the first four
+        // and 1 for the rest
+        vector<int> priority;
+
+        // Prefetches in flight from the last level cache. A prefetch is
+        // turned down once readq is prefetch_readq_limit full, leaving the
+        // rest to demand reads. The PADC scheduler takes the prefetches
+        // of a core as accurate from prefetch_accuracy_threshold up.
+        shared_ptr<PrefetchTags> prefetch_tags;
+        float prefetch_readq_limit = 0.75f;
+        double prefetch_accuracy_threshold = 0.85;
 
         Scheduler<T>* scheduler;  // determines the highest priority request
                                   // whose commands will be issued
@@ -94,6 +174,33 @@ namespace ramulator {
             list<Request> q;
             unsigned int max = 32;
             unsigned int size() { return q.size(); }
+
+            // Bank view of q. Every request has an entry in the list of its
+            // bank (the row group above Row), in queue order, with its row
+            // hit state cached until a row of the bank is opened or closed.
+            // The scheduler then decodes one command per bank instead of
+            // one per request. otherq is not indexed since refresh requests
+            // have no bank.
+            struct Entry {
+                list<Request>::iterator req;
+                long key;      // bank and row, see get_row_key()
+                long seq;      // order in q
+                long version;  // bank version that hit and open belong to
+                bool hit;
+                bool open;
+                bool ready;  // set each time the scheduler looks at the bank
+                bool prefetch;  // see is_prefetch()
+            };
+            bool indexed = false;
+            vector<vector<Entry>> banks;
+            vector<int> active;  // banks that have requests
+            // Entries with hit set in each group of banks closed together
+            // by a PRE, kept up to date as entries change
+            vector<int> group_hits;
+            // Number of entries with each key, for the rows that have any
+            unordered_map<long, int> row_reqs;
+            long seq = 0;
+            long promotions = 0;  // prefetch promotions the entries know of
         };
 
         Queue readq;   // queue for read requests
@@ -105,31 +212,138 @@ namespace ramulator {
                      // WRITE command)
         Queue otherq;  // queue for all "other" requests (e.g., refresh)
 
-        deque<Request>
+        // Addresses of the writes in writeq (indexed queues only). There
+        // is at most one write per address since later ones are merged.
+        unordered_set<long> write_addrs;
+
+        // Flat index of the row groups above Row (e.g., rank, bank group and
+        // bank), and a version per row group that changes whenever one of
+        // its rows is opened or closed
+        vector<int> bank_stride;
+        int bank_num = 1;
+        int row_num;
+        vector<long> bank_version;
+        int pre_group_size;  // row groups closed together by a PRE
+
+        PendingQueue
             pending;  // read requests that are about to receive data from DRAM
+        vector<Request> retired;  // reads served in this cycle
+        list<Request> free_nodes;  // queue nodes kept for reuse by push()
         bool write_mode =
             false;  // whether write requests should be prioritized over reads
         float wr_high_watermark =
             0.8f;  // threshold for switching to write mode
         float wr_low_watermark =
             0.2f;  // threshold for switching back to read mode
+
+        // Adaptive write drain (write_drain = adaptive). A drain issues at
+        // least drain_min_batch writes, unless writeq runs empty, before
+        // turning the bus around to reads, and it drains row by row (see
+        // get_drain_head()). Every drain_epoch cycles, wr_high_watermark is
+        // raised if reads were queued and lowered if they were not.
+        bool adaptive_drain = false;
+        long drain_min_batch = 8;
+        long drain_epoch = 10000;
+        long drain_epoch_end;
+        long drain_read_sum = 0;  // readq length summed over the epoch
+        long drain_writes = 0;    // writes issued in this write mode
+        bool last_access_write = false;  // last RD/WR was a write
+        // tick() has found nothing to issue, and nothing can be issued
+        // before this cycle (see next_event())
+        long idle_until = 0;
         // long refreshed = 0;  // last time refresh requests were generated
 
         /* Command trace for DRAMPower 3.1 */
         string cmd_trace_prefix = "cmd-trace-";
-        vector<ofstream> cmd_trace_files;
+        unique_ptr<CmdTrace> cmd_trace;
         bool record_cmd_trace = false;
+        // DDR4 and GDDR5 number the banks of a rank across bank groups
+        int cmd_trace_group_banks = 0;
         /* Commands to stdout */
         bool print_cmd_trace = false;
 
+        // Counters sampled every stats_interval cycles, if set
+        unique_ptr<TimeSeries> series;
+
+        // DRAM-aware writeback (dram_aware_writeback = on). The lines of a
+        // row differ only in the column bits of their address, which sit
+        // above the transaction and channel bits in Memory's default
+        // RoBaRaCoCh mapping.
+        shared_ptr<WritebackLink> writeback_link;
+        bool dram_aware_writeback = false;
+        long writeback_tx_mask;    // offset bits within a transaction
+        int writeback_col_offset;  // lowest column bit of an address
+        int writeback_cols;        // columns of a row, in transactions
+        vector<long> writeback_addrs;  // the other lines of a row
+        vector<long> writeback_dirty;  // those the cache cleaned
+        // Lines written back early that are queued and not issued yet.
+        // They come from no core, so they are left out of the per-core
+        // scheduler state and of Memory's request stats.
+        unordered_set<long> writeback_lines;
+
         /* Constructor */
         Controller(const Config& configs, DRAM<T>* channel)
             : channel(channel),
+              core_num(configs.get_core_num()),
+              blacklist(Blacklist::get(configs)),
+              numRequestsPerCore(core_num, 0),
+              priority(core_num, 1),
+              prefetch_tags(PrefetchTags::get(configs)),
               scheduler(new Scheduler<T>(configs, this)),  // Saugata
               rowpolicy(new RowPolicy<T>(this)),
               rowtable(new RowTable<T>(this)),
               refresh(new Refresh<T>(this)),
-              cmd_trace_files(channel->children.size()) {
+              writeback_link(WritebackLink::get(configs)) {
+            const int default_priority[] = {1, 4, 2, 1};
+            for (int i = 0; i < min(core_num, 4); i++)
+                priority[i] = default_priority[i];
+
+            if (configs["write_drain"] == "adaptive") adaptive_drain = true;
+            if (configs.contains("write_drain_min_batch")) {
+                drain_min_batch = stol(configs["write_drain_min_batch"]);
+            }
+            if (configs.contains("write_drain_epoch")) {
+                drain_epoch = stol(configs["write_drain_epoch"]);
+                assert(drain_epoch > 0);
+            }
+            drain_epoch_end = drain_epoch;
+
+            if (configs.contains("prefetch_readq_limit")) {
+                prefetch_readq_limit = stof(configs["prefetch_readq_limit"]);
+            }
+            if (configs.contains("prefetch_accuracy_threshold")) {
+                prefetch_accuracy_threshold =
+                    stod(configs["prefetch_accuracy_threshold"]);
+            }
+
+            if (configs["dram_aware_writeback"] == "on") {
+                // Rows are laid out for Memory's default mapping only
+                string mapping = configs["mapping"];
+                if (mapping != "" && mapping != "defaultmapping") {
+                    fprintf(stderr,
+                            "dram_aware_writeback needs the default "
+                            "RoBaRaCoCh mapping, not %s\n",
+                            mapping.c_str());
+                    exit(1);
+                }
+                dram_aware_writeback = true;
+                T* spec = channel->spec;
+                auto log2 = [](long val) {
+                    int bits = 0;
+                    while ((1l << bits) < val) bits++;
+                    return bits;
+                };
+                long tx = spec->prefetch_size * spec->channel_width / 8;
+                writeback_link->set_line_size(tx);
+                writeback_tx_mask = tx - 1;
+                writeback_col_offset =
+                    log2(tx) +
+                    log2(spec->org_entry.count[int(T::Level::Channel)]);
+                writeback_cols =
+                    spec->org_entry.count[int(T::Level::MAX) - 1] /
+                    spec->prefetch_size;
+            }
+
             record_cmd_trace = configs.record_cmd_trace();
             print_cmd_trace = configs.print_cmd_trace();
             if (record_cmd_trace) {
@@ -138,9 +352,41 @@ namespace ramulator {
                 }
                 string prefix = cmd_trace_prefix + "chan-" +
                                 to_string(channel->id) + "-rank-";
-                string suffix = ".cmdtrace";
-                for (unsigned int i = 0; i < channel->children.size(); i++)
-                    cmd_trace_files[i].open(prefix + to_string(i) + suffix);
+                T* spec = channel->spec;
+                vector<string> command_names(
+                    spec->command_name,
+                    spec->command_name + int(T::Command::MAX));
+                cmd_trace.reset(new CmdTrace(
+                    prefix, channel->children.size(), command_names,
+                    configs["cmd_trace_format"] == "binary"));
+                if (spec->standard_name == "DDR4" ||
+                    spec->standard_name == "GDDR5")
+                    cmd_trace_group_banks =
+                        spec->org_entry.count[int(T::Level::Bank)];
+            }
+
+            bank_stride.assign(int(T::Level::Row), 0);
+            for (int lev = int(T::Level::Row) - 1; lev > 0; lev--) {
+                bank_stride[lev] = bank_num;
+                bank_num *= channel->spec->org_entry.count[lev];
+            }
+            bank_version.assign(bank_num, 0);
+            row_num = channel->spec->org_entry.count[int(T::Level::Row)];
+            int pre_scope = int(channel->spec->scope[int(T::Command::PRE)]);
+            if (pre_scope < 1)
+                pre_group_size = bank_num;
+            else if (pre_scope >= int(T::Level::Row) - 1)
+                pre_group_size = 1;
+            else
+                pre_group_size = bank_stride[pre_scope];
+            rowtable->init();
+
+            // The TLDRAM tick (Controller.cpp) edits the request lists
+            // directly, so its queues stay plain lists
+            for (Queue* queue : {&readq, &writeq, &actq}) {
+                queue->indexed = !is_same<T, TLDRAM>::value;
+                queue->banks.resize(bank_num);
+                queue->group_hits.assign(bank_num / pre_group_size, 0);
             }
 
             // regStats
@@ -209,6 +455,58 @@ namespace ramulator {
                     "WR")
                 .precision(0);
 
+            forwarded_reads
+                .name("forwarded_reads_" + to_string(channel->id))
+                .desc(
+                    "Number of reads served by a queued write to the same "
+                    "address")
+                .precision(0);
+            merged_writes.name("merged_writes_" + to_string(channel->id))
+                .desc(
+                    "Number of writes merged into a queued write to the same "
+                    "address")
+                .precision(0);
+            write_drains.name("write_drains_" + to_string(channel->id))
+                .desc("Number of write modes that issued writes")
+                .precision(0);
+            write_drain_length_sum
+                .name("write_drain_length_sum_" + to_string(channel->id))
+                .desc("Writes issued in write mode")
+                .precision(0);
+            write_drain_length_avg
+                .name("write_drain_length_avg_" + to_string(channel->id))
+                .desc("Average writes issued per drain")
+                .precision(6);
+            write_drain_length_max
+                .name("write_drain_length_max_" + to_string(channel->id))
+                .desc("Most writes issued in one drain")
+                .precision(0);
+            read_to_write_turnarounds
+                .name("read_to_write_turnarounds_" + to_string(channel->id))
+                .desc("Number of writes issued right after a read")
+                .precision(0);
+            write_to_read_turnarounds
+                .name("write_to_read_turnarounds_" + to_string(channel->id))
+                .desc("Number of reads issued right after a write")
+                .precision(0);
+            prefetch_reads.name("prefetch_reads_" + to_string(channel->id))
+                .desc("Number of prefetches from the cache queued as reads")
+                .precision(0);
+            dropped_prefetches
+                .name("dropped_prefetches_" + to_string(channel->id))
+                .desc("Number of prefetches turned down by a busy read queue")
+                .precision(0);
+            stale_prefetches
+                .name("stale_prefetches_" + to_string(channel->id))
+                .desc("Number of prefetches dropped from a full read queue")
+                .precision(0);
+            early_writebacks
+                .name("early_writebacks_" + to_string(channel->id))
+                .desc(
+                    "Number of dirty cache lines written back to an open row "
+                    "before eviction")
+                .precision(0);
+
             read_transaction_bytes
                 .name("read_transaction_bytes_" + to_string(channel->id))
                 .desc("The total byte of read transaction per channel")
@@ -298,6 +596,26 @@ namespace ramulator {
                     "record write conflict for this core when it reaches "
                     "request limit or to the end");
 #endif
+
+            series.reset(TimeSeries::create(
+                configs, "chan-" + to_string(channel->id)));
+            if (series) {
+                series->add("row_hits", [this] { return row_hits.value(); });
+                series->add("row_misses",
+                            [this] { return row_misses.value(); });
+                series->add("row_conflicts",
+                            [this] { return row_conflicts.value(); });
+                series->add("readq", [this] { return readq.size(); });
+                series->add("writeq", [this] { return writeq.size(); });
+                series->add("actq", [this] { return actq.size(); });
+                series->add("pending", [this] { return pending.size(); });
+                series->add("write_mode", [this] { return write_mode; });
+                for (int i = 0; i < core_num; i++)
+                    series->add("requests_core_" + to_string(i),
+                                [this, i] { return numRequestsPerCore[i]; });
+                series->add("blacklist",
+                            [this] { return blacklist->bStatus; });
+            }
         }
 
         ~Controller() {
@@ -306,8 +624,6 @@ namespace ramulator {
             delete rowtable;
             delete channel;
             delete refresh;
-            for (auto& file : cmd_trace_files) file.close();
-            cmd_trace_files.clear();
         }
 
         void finish(long read_req, long dram_cycles) {
@@ -317,6 +633,11 @@ namespace ramulator {
                 read_req_queue_length_sum.value() / dram_cycles;
             write_req_queue_length_avg =
                 write_req_queue_length_sum.value() / dram_cycles;
+            if (cmd_trace) cmd_trace->flush();
+            if (series) series->dump();
+            if (write_drains.value() > 0)
+                write_drain_length_avg =
+                    write_drain_length_sum.value() / write_drains.value();
             // call finish function of each channel
             channel->finish(dram_cycles);
         }
@@ -335,71 +656,306 @@ namespace ramulator {
 
         bool enqueue(Request& req) {
             Queue& queue = get_queue(req.type);
+
+            // A read or write to the address of a queued write doesn't
+            // take a queue slot: the read is served by the write (necessary
+            // for coherence), and the write is merged into it and done.
+            if (writeq.indexed &&
+                (req.type == Request::Type::READ ||
+                 req.type == Request::Type::WRITE) &&
+                write_addrs.count(req.addr)) {
+                req.arrive = clk;
+                if (req.type == Request::Type::READ) {
+                    req.depart = clk + 1;
+                    pending.push_back(req);
+                    ++forwarded_reads;
+                } else {
+                    ++merged_writes;
+                    req.callback(req);
+                }
+                return true;
+            }
+
+            if (req.type == Request::Type::READ &&
+                prefetch_tags->contains(req.addr)) {
+                if (readq.size() >= prefetch_readq_limit * readq.max) {
+                    ++dropped_prefetches;
+                    return false;
+                }
+                ++prefetch_reads;
+            }
+
+            if (&queue == &readq && queue.max == queue.size() &&
+                scheduler->type == Scheduler<T>::Type::PADC) {
+                drop_stale_prefetches();
+            }
             if (queue.max == queue.size()) return false;
 
             req.arrive = clk;
-            queue.q.push_back(req);
             // shortcut for read requests, if a write to same addr exists
             // necessary for coherence
-            if (req.type == Request::Type::READ &&
+            if (!writeq.indexed && req.type == Request::Type::READ &&
                 find_if(writeq.q.begin(), writeq.q.end(), [req](Request& wreq) {
                     return req.addr == wreq.addr;
                 }) != writeq.q.end()) {
                 req.depart = clk + 1;
                 pending.push_back(req);
-                readq.q.pop_back();
+                ++forwarded_reads;
+                return true;
+            }
+            push(queue, req);
+            // The queued requests are as ready as they were
+            if (idle_until > clk + 1) {
+                auto added = prev(queue.q.end());
+                idle_until = min(idle_until,
+                                 channel->get_next(get_first_cmd(added),
+                                                   added->addr_vec.data()));
             }
             return true;
         }
 
+        int get_bank(const vector<int>& addr_vec) {
+            int bank = 0;
+            for (int lev = 1; lev < int(T::Level::Row); lev++)
+                bank += addr_vec[lev] * bank_stride[lev];
+            return bank;
+        }
+
+        // Packed key of the row of addr_vec in the given bank
+        long get_row_key(int bank, const vector<int>& addr_vec) {
+            return long(bank) * row_num + addr_vec[int(T::Level::Row)];
+        }
+
+        // Banks under the prefix of addr_vec down to level scope
+        void get_bank_range(int scope, const vector<int>& addr_vec,
+                            int& first, int& num) {
+            first = 0;
+            num = bank_num;
+            for (int lev = 1; lev <= min(scope, int(T::Level::Row) - 1);
+                 lev++) {
+                first += addr_vec[lev] * bank_stride[lev];
+                num = bank_stride[lev];
+            }
+        }
+
+        // Queue nodes are recycled through free_nodes rather than allocated
+        // and freed for every request, and a request moves between queues
+        // by relinking its node instead of copying it.
+        void push(Queue& queue, const Request& req) {
+            if (free_nodes.empty()) {
+                queue.q.push_back(req);
+            } else {
+                queue.q.splice(queue.q.end(), free_nodes, free_nodes.begin());
+                queue.q.back() = req;
+            }
+            index(queue, prev(queue.q.end()));
+        }
+
+        // The node stays valid (in free_nodes) until the next push
+        void erase(Queue& queue, list<Request>::iterator req) {
+            unindex(queue, req);
+            free_nodes.splice(free_nodes.begin(), queue.q, req);
+        }
+
+        void transfer(Queue& from, Queue& to, list<Request>::iterator req) {
+            unindex(from, req);
+            to.q.splice(to.q.end(), from.q, req);
+            index(to, req);
+        }
+
+        void index(Queue& queue, list<Request>::iterator req) {
+            if (!queue.indexed) return;
+
+            if (&queue == &writeq) write_addrs.insert(req->addr);
+
+            int bank = get_bank(req->addr_vec);
+            auto& entries = queue.banks[bank];
+            if (entries.empty()) queue.active.push_back(bank);
+            long key = get_row_key(bank, req->addr_vec);
+            entries.push_back({req, key, queue.seq++, -1, false, false, false,
+                               is_prefetch(*req)});
+            queue.row_reqs[key]++;
+        }
+
+        void unindex(Queue& queue, list<Request>::iterator req) {
+            if (!queue.indexed) return;
+
+            if (&queue == &writeq) write_addrs.erase(req->addr);
+
+            int bank = get_bank(req->addr_vec);
+            auto& entries = queue.banks[bank];
+            auto entry = find_if(entries.begin(), entries.end(),
+                                 [req](const typename Queue::Entry& e) {
+                                     return e.req == req;
+                                 });
+            if (entry->hit) queue.group_hits[bank / pre_group_size]--;
+            auto row = queue.row_reqs.find(entry->key);
+            if (--row->second == 0) queue.row_reqs.erase(row);
+            entries.erase(entry);
+            if (entries.empty()) {
+                auto it = find(queue.active.begin(), queue.active.end(), bank);
+                *it = queue.active.back();
+                queue.active.pop_back();
+            }
+        }
+
+        // Bring the cached row hit state of the queued requests up to date
+        // and decode readiness once per bank and kind of command
+        void update_entries(Queue& queue) {
+            // A demand request merged into a prefetch since the last look
+            if (queue.promotions != prefetch_tags->promotions) {
+                queue.promotions = prefetch_tags->promotions;
+                for (int bank : queue.active)
+                    for (auto& entry : queue.banks[bank])
+                        entry.prefetch = is_prefetch(*entry.req);
+            }
+            for (int bank : queue.active) {
+                // indexed by 2 * is_write + hit, -1 if not decoded yet
+                signed char ready[4] = {-1, -1, -1, -1};
+                for (auto& entry : queue.banks[bank]) {
+                    if (entry.version != bank_version[bank]) {
+                        bool hit = is_row_hit(entry.req);
+                        if (hit != entry.hit)
+                            queue.group_hits[bank / pre_group_size] +=
+                                hit ? 1 : -1;
+                        entry.hit = hit;
+                        entry.open = is_row_open(entry.req);
+                        entry.version = bank_version[bank];
+                    }
+                    int kind =
+                        2 * (entry.req->type == Request::Type::WRITE) +
+                        entry.hit;
+                    if (ready[kind] < 0) ready[kind] = is_ready(entry.req);
+                    entry.ready = ready[kind];
+                }
+            }
+        }
+
+        void update_write_mode() {
+            if (adaptive_drain && clk >= drain_epoch_end) {
+                // average reads queued over the epoch, as a share of readq
+                float pressure =
+                    float(drain_read_sum) / (drain_epoch * readq.max);
+                if (pressure > 0.25f)
+                    wr_high_watermark = min(wr_high_watermark + 0.05f, 0.95f);
+                else
+                    wr_high_watermark = max(wr_high_watermark - 0.05f,
+                                            wr_low_watermark + 0.1f);
+                drain_read_sum = 0;
+                drain_epoch_end += drain_epoch;
+            }
+
+            if (!write_mode) {
+                // yes -- write queue is almost full or read queue is empty
+                if (writeq.size() >
+                        (unsigned int)(wr_high_watermark * writeq.max) ||
+                    readq.size() == 0) {
+                    write_mode = true;
+                    drain_writes = 0;
+                }
+            } else {
+                // no -- write queue is almost empty and read queue is not
+                // empty, and the drain made up for the turnaround
+                if (writeq.size() <
+                        (unsigned int)(wr_low_watermark * writeq.max) &&
+                    readq.size() != 0 &&
+                    (!adaptive_drain || drain_writes >= drain_min_batch ||
+                     writeq.size() == 0)) {
+                    write_mode = false;
+                    if (drain_writes > 0) {
+                        write_drains++;
+                        write_drain_length_sum += drain_writes;
+                        if (drain_writes > write_drain_length_max.value())
+                            write_drain_length_max = drain_writes;
+                    }
+                }
+            }
+        }
+
+        // Head of writeq for the adaptive drain: the ready write that hits
+        // in an open row, else the one whose row has the most writes
+        // queued, oldest first. Rows with writes that hit are not closed.
+        // The entries are up to date after scheduler->get_head(writeq).
+        list<Request>::iterator get_drain_head(list<Request>::iterator head) {
+            const typename Queue::Entry* best = nullptr;
+            int best_reqs = 0;
+            for (int bank : writeq.active) {
+                bool protect = writeq.group_hits[bank / pre_group_size] > 0;
+                for (auto& entry : writeq.banks[bank]) {
+                    if (!entry.ready || (protect && !entry.hit)) continue;
+                    int reqs = writeq.row_reqs[entry.key];
+                    if (!best || entry.hit > best->hit ||
+                        (entry.hit == best->hit &&
+                         (reqs > best_reqs ||
+                          (reqs == best_reqs && entry.seq < best->seq)))) {
+                        best = &entry;
+                        best_reqs = reqs;
+                    }
+                }
+            }
+            return best ? best->req : head;
+        }
+
+        // With DRAM-aware writeback, a drain rather waits for the writes
+        // that hit in open rows to be ready than opens another row, which
+        // would hold actq and let the rows written back early time out.
+        // The entries are up to date after scheduler->get_head(writeq).
+        bool wait_for_write_hits(list<Request>::iterator head) {
+            if (head != writeq.q.end() && is_ready(head) && is_row_hit(head))
+                return false;
+            for (int hits : writeq.group_hits)
+                if (hits > 0) return true;
+            return false;
+        }
+
         void tick() {
             // * This is the cycle count tracking in the lab handout
             clk++;
+            if (series) series->sample(clk);
+            // Every clearing interval, the blacklist should be cleared
+            blacklist->update(clk);
             req_queue_length_sum +=
                 readq.size() + writeq.size() + pending.size();
             read_req_queue_length_sum += readq.size() + pending.size();
             write_req_queue_length_sum += writeq.size();
+            drain_read_sum += readq.size();
 
             /*** 1. Serve completed reads ***/
-            if (pending.size()) {
-                Request& req = pending[0];
-                if (req.depart <= clk) {
+            // All reads that are due retire together. The channel is
+            // updated for all of them before the first callback.
+            while (pending.size() && pending.top().depart <= clk) {
+                retired.push_back(move(pending.top()));
+                pending.pop_front();
+            }
+            if (retired.size()) {
+                for (auto& req : retired) {
                     if (req.depart - req.arrive >
                         1) {  // this request really accessed a row
                         read_latency_sum += req.depart - req.arrive;
                         channel->update_serving_requests(req.addr_vec.data(),
                                                          -1, clk);
                     }
-                    req.callback(req);
-                    pending.pop_front();
                 }
+                for (auto& req : retired) req.callback(req);
+                retired.clear();
             }
 
             /*** 2. Refresh scheduler ***/
             refresh->tick_ref();
 
             /*** 3. Should we schedule writes? ***/
-            if (!write_mode) {
-                // yes -- write queue is almost full or read queue is empty
-                if (writeq.size() >
-                        (unsigned int)(wr_high_watermark * writeq.max) ||
-                    readq.size() == 0)
-                    write_mode = true;
-            } else {
-                // no -- write queue is almost empty and read queue is not empty
-                if (writeq.size() <
-                        (unsigned int)(wr_low_watermark * writeq.max) &&
-                    readq.size() != 0)
-                    write_mode = false;
-            }
+            update_write_mode();
 
             /*** 4. Find the best command to schedule, if any ***/
 
+            // Nothing can issue before idle_until (see next_event())
+            if (clk < idle_until) return;
+
             // First check the actq (which has higher priority) to see if there
             // are requests available to service in this cycle
             Queue* queue = &actq;
 
-            auto req = scheduler->get_head(queue->q);
+            auto req = scheduler->get_head(*queue);
             if ((req == queue->q.end() || !is_ready(req)) && actq.size() == 0) {
                 queue = !write_mode ? &readq : &writeq;
 
@@ -407,16 +963,25 @@ namespace ramulator {
                     queue = &otherq;  // "other" requests are rare, so we give
                                       // them precedence over reads/writes
 
-                req = scheduler->get_head(queue->q);
+                req = scheduler->get_head(*queue);
+                if (queue == &writeq && adaptive_drain && writeq.indexed)
+                    req = get_drain_head(req);
+                if (queue == &writeq && dram_aware_writeback &&
+                    writeq.indexed && wait_for_write_hits(req))
+                    req = writeq.q.end();
             }
 
             if (req == queue->q.end() || !is_ready(req)) {
                 // we couldn't find a command to schedule -- let's try to be
                 // speculative
                 auto cmd = T::Command::PRE;
-                vector<int> victim = rowpolicy->get_victim(cmd);
-                if (!victim.empty()) {
-                    issue_cmd(cmd, victim);
+                const vector<int>* victim = rowpolicy->find_victim(cmd);
+                if (victim) {
+                    issue_cmd(cmd, *victim);
+                } else if (scheduler->type != Scheduler<T>::Type::Custom) {
+                    // The Custom compare clears the blacklist as it goes,
+                    // so it looks every cycle
+                    idle_until = next_event();
                 }
                 return;  // nothing more to be done this cycle
             }
@@ -432,38 +997,20 @@ namespace ramulator {
 
                 // * Blacklisting algorithm for BLISS
 
-                // Every 10,000 cycles, the blacklist should be cleared
-                if (clk % 10000 == 0) {
-                    for (int i = 0; i < 4; i++) {
-                        bStatus[i] = false;
-                    }
-                }
-
                 // Get the current ID
                 int coreid = req->coreid;
 
-                if (coreid == lastCoreID) {
-                    // If the core ID is the same as the last one, increment
-                    numRequests++;
-                } else {
-                    // If the core ID is different, reset the counter
-                    numRequests = 0;
-                }
-
-                // Check against the threshold
-                int threshold = 4;  // Noted in page 8, first bullet at bottom
-                if (numRequests >= threshold) {
-                    bStatus[coreid] = true;
-                    numRequests = 0;
-                }
+                // Writes queued by write_back_row() belong to no core
+                bool early_writeback = dram_aware_writeback &&
+                                       req->type == Request::Type::WRITE &&
+                                       writeback_lines.erase(req->addr);
 
-                // Update the last core ID
-                lastCoreID = coreid;
+                if (!early_writeback) blacklist->serve(coreid);
 
                 // * Counting algorithms for Equity
 
                 // Increment the number of requests for this core
-                numRequestsPerCore[coreid]++;
+                if (!early_writeback) numRequestsPerCore[coreid]++;
 
                 req->is_first_command = false;
                 // int coreid = req->coreid;
@@ -503,7 +1050,11 @@ namespace ramulator {
 
             // issue command on behalf of request
             auto cmd = get_first_cmd(req);
-            issue_cmd(cmd, get_addr_vec(cmd, req));
+            // only SALP issues to an address other than the request's
+            if (is_same<T, SALP>::value)
+                issue_cmd(cmd, get_addr_vec(cmd, req));
+            else
+                issue_cmd(cmd, req->addr_vec);
 
             // check whether this is the last command (which finishes the
             // request)
@@ -513,26 +1064,110 @@ namespace ramulator {
                 if (channel->spec->is_opening(cmd)) {
                     // promote the request that caused issuing activation to
                     // actq
-                    actq.q.push_back(*req);
-                    queue->q.erase(req);
+                    transfer(*queue, actq, req);
                 }
 
                 return;
             }
 
-            // set a future completion time for read requests
+            // set a future completion time for read requests, and move them
+            // out of the queue into pending
             if (req->type == Request::Type::READ) {
                 req->depart = clk + channel->spec->read_latency;
-                pending.push_back(*req);
+                erase(*queue, req);
+                pending.push_back(move(*req));
+                return;
             }
 
+            bool write_back = false;
             if (req->type == Request::Type::WRITE) {
                 channel->update_serving_requests(req->addr_vec.data(), -1, clk);
                 req->callback(*req);
+                if (write_mode) drain_writes++;
+                write_back = dram_aware_writeback && write_mode &&
+                             !channel->spec->is_closing(cmd);
             }
 
             // remove request from queue
-            queue->q.erase(req);
+            if (write_back) {
+                // The erased node is the next one push() reuses
+                long addr = req->addr;
+                vector<int> addr_vec = req->addr_vec;
+                erase(*queue, req);
+                write_back_row(addr, addr_vec);
+                return;
+            }
+            erase(*queue, req);
+        }
+
+        // Queue the dirty lines the cache holds in the row of the write
+        // just served, if no other queued write keeps the row busy. They
+        // only fill writeq up to the high watermark, so the drain still
+        // ends.
+        void write_back_row(long addr, const vector<int>& addr_vec) {
+            long room = long(wr_high_watermark * writeq.max) - writeq.size();
+            if (!writeback_link->clean || room <= 0) return;
+            int bank = get_bank(addr_vec);
+            if (writeq.indexed &&
+                writeq.row_reqs.count(get_row_key(bank, addr_vec)))
+                return;
+
+            addr &= ~writeback_tx_mask;
+            long col_mask = long(writeback_cols - 1) << writeback_col_offset;
+            long row = addr & ~col_mask;
+            writeback_addrs.clear();
+            for (long col = 0; col < writeback_cols; col++) {
+                long line = row | (col << writeback_col_offset);
+                if (line != addr) writeback_addrs.push_back(line);
+            }
+
+            writeback_dirty.clear();
+            writeback_link->clean(writeback_addrs, room, writeback_dirty);
+            // There was room in writeq for every cleaned line
+            int col_level = int(T::Level::MAX) - 1;
+            for (long line : writeback_dirty) {
+                Request write(line, Request::Type::WRITE);
+                write.addr_vec = addr_vec;
+                write.addr_vec[col_level] =
+                    (line & col_mask) >> writeback_col_offset;
+                // Unless it merges into a write queued to the line
+                if (!write_addrs.count(line)) writeback_lines.insert(line);
+                enqueue(write);
+                ++early_writebacks;
+            }
+        }
+
+        // Earliest cycle at which tick() can do more than count queue
+        // lengths: the head of pending departs, a refresh is due, or a
+        // request that tick() may pick or the row policy has a
+        // timing-legal command. While actq holds requests, tick() picks
+        // from actq only. Nothing issues before then, so the decoded first
+        // commands stay the same and tick() doesn't look for a command
+        // until then (see idle_until). Returns LONG_MAX if the channel
+        // waits for the next enqueue. SALP and TLDRAM channels always
+        // return clk + 1 (see below), so they look every cycle.
+        long next_event() {
+            long next = LONG_MAX;
+            if (pending.size()) next = pending.top().depart;
+
+            // refresh->clk advances with clk in tick_ref()
+            next = min(next, clk + refresh->refreshed +
+                                 channel->spec->speed_entry.nREFI -
+                                 refresh->clk);
+
+            for (Queue* queue : {&actq, &readq, &writeq, &otherq}) {
+                if (queue != &actq && actq.size()) break;
+                for (auto itr = queue->q.begin(); itr != queue->q.end();
+                     ++itr) {
+                    next = min(next, channel->get_next(get_first_cmd(itr),
+                                                       itr->addr_vec.data()));
+                }
+            }
+
+            next = min(next, rowpolicy->get_next_victim(T::Command::PRE));
+            // the watermarks move at the end of a drain epoch
+            if (adaptive_drain) next = min(next, drain_epoch_end);
+            return max(next, clk + 1);
         }
 
         bool is_ready(list<Request>::iterator req) {
@@ -566,6 +1201,60 @@ namespace ramulator {
 
         void update_temp(ALDRAM::Temp current_temperature) {}
 
+        // PADC request classes. A read the last level cache prefetched is
+        // critical if the prefetches of its core are accurate, and the
+        // demand reads of the other cores are urgent. The scheduler reads
+        // the prefetch bit from the queue entry, set when the request is
+        // queued and again when a demand request merges into a prefetch.
+        bool is_prefetch(const Request& req) {
+            return req.type == Request::Type::READ &&
+                   prefetch_tags->contains(req.addr);
+        }
+
+        bool is_accurate(int coreid) {
+            return prefetch_tags->accuracy(coreid) >=
+                   prefetch_accuracy_threshold;
+        }
+
+        bool is_critical(const typename Queue::Entry& entry) {
+            return !entry.prefetch || is_accurate(entry.req->coreid);
+        }
+
+        bool is_urgent(const typename Queue::Entry& entry) {
+            return entry.req->type == Request::Type::READ &&
+                   !entry.prefetch && !is_accurate(entry.req->coreid);
+        }
+
+        // Cycles a prefetch of coreid may wait in readq before it is
+        // dropped. The steps are those of PADC, in controller cycles.
+        long prefetch_drop_age(int coreid) {
+            double accuracy = prefetch_tags->accuracy(coreid);
+            if (accuracy < 0.1) return 100;
+            if (accuracy < 0.3) return 1500;
+            if (accuracy < 0.7) return 50000;
+            return 100000;
+        }
+
+        // A prefetch whose first command was issued is already counted
+        // as served by the channel and in the row stats, and is kept
+        void drop_stale_prefetches() {
+            for (auto it = readq.q.begin(); it != readq.q.end();) {
+                auto req = it++;
+                if (!req->is_first_command || !is_prefetch(*req) ||
+                    clk - req->arrive <= prefetch_drop_age(req->coreid)) {
+                    continue;
+                }
+                Request dropped = *req;
+                erase(readq, req);
+                ++stale_prefetches;
+                if (prefetch_tags->drop) prefetch_tags->drop(dropped);
+            }
+        }
+
+        bool is_blacklisted(int coreid) {
+            return blacklist->is_blacklisted(coreid);
+        }
+
         // For telling whether this channel is busying in processing read or
         // write
         bool is_active() { return (channel->cur_serving_requests > 0); }
@@ -607,33 +1296,9 @@ namespace ramulator {
                 // check if it is the last request to the opened row
                 Queue* queue = write_mode ? &writeq : &readq;
 
-                auto begin = addr_vec.begin();
-                vector<int> rowgroup(begin, begin + int(T::Level::Row) + 1);
-
-                int num_row_hits = 0;
-
-                for (auto itr = queue->q.begin(); itr != queue->q.end();
-                     ++itr) {
-                    if (is_row_hit(itr)) {
-                        auto begin2 = itr->addr_vec.begin();
-                        vector<int> rowgroup2(begin2,
-                                              begin2 + int(T::Level::Row) + 1);
-                        if (rowgroup == rowgroup2) num_row_hits++;
-                    }
-                }
-
-                if (num_row_hits == 0) {
-                    Queue* queue = &actq;
-                    for (auto itr = queue->q.begin(); itr != queue->q.end();
-                         ++itr) {
-                        if (is_row_hit(itr)) {
-                            auto begin2 = itr->addr_vec.begin();
-                            vector<int> rowgroup2(
-                                begin2, begin2 + int(T::Level::Row) + 1);
-                            if (rowgroup == rowgroup2) num_row_hits++;
-                        }
-                    }
-                }
+                int num_row_hits = count_row_hits(*queue, addr_vec);
+                if (num_row_hits == 0)
+                    num_row_hits = count_row_hits(actq, addr_vec);
 
                 assert(num_row_hits >
                        0);  // The current request should be a hit,
@@ -650,10 +1315,40 @@ namespace ramulator {
             }
         }
 
+        // Requests in queue that hit in the row of addr_vec, which is open.
+        // Indexed queues count the requests to each row as they change.
+        int count_row_hits(Queue& queue, const vector<int>& addr_vec) {
+            if (queue.indexed) {
+                auto row = queue.row_reqs.find(
+                    get_row_key(get_bank(addr_vec), addr_vec));
+                return row == queue.row_reqs.end() ? 0 : row->second;
+            }
+
+            int num_row_hits = 0;
+            auto end = addr_vec.begin() + int(T::Level::Row) + 1;
+            for (auto itr = queue.q.begin(); itr != queue.q.end(); ++itr) {
+                if (is_row_hit(itr) &&
+                    equal(addr_vec.begin(), end, itr->addr_vec.begin()))
+                    num_row_hits++;
+            }
+            return num_row_hits;
+        }
+
         void issue_cmd(typename T::Command cmd, const vector<int>& addr_vec) {
             cmd_issue_autoprecharge(cmd, addr_vec);
             assert(is_ready(cmd, addr_vec));
             channel->update(cmd, addr_vec.data(), clk);
+            update_bank_version(cmd, addr_vec);
+
+            if (channel->spec->is_accessing(cmd)) {
+                bool is_write =
+                    cmd == T::Command::WR || cmd == T::Command::WRA;
+                if (is_write && !last_access_write)
+                    read_to_write_turnarounds++;
+                else if (!is_write && last_access_write)
+                    write_to_read_turnarounds++;
+                last_access_write = is_write;
+            }
 
             if (cmd == T::Command::PRE) {
                 if (rowtable->get_hits(addr_vec, true) == 0) {
@@ -663,22 +1358,11 @@ namespace ramulator {
 
             rowtable->update(cmd, addr_vec, clk);
             if (record_cmd_trace) {
-                // select rank
-                auto& file = cmd_trace_files[addr_vec[1]];
-                string& cmd_name = channel->spec->command_name[int(cmd)];
-                file << clk << ',' << cmd_name;
-                // TODO bad coding here
-                if (cmd_name == "PREA" || cmd_name == "REF")
-                    file << endl;
-                else {
-                    int bank_id = addr_vec[int(T::Level::Bank)];
-                    if (channel->spec->standard_name == "DDR4" ||
-                        channel->spec->standard_name == "GDDR5")
-                        bank_id +=
-                            addr_vec[int(T::Level::Bank) - 1] *
-                            channel->spec->org_entry.count[int(T::Level::Bank)];
-                    file << ',' << bank_id << endl;
-                }
+                // the bank is left out of rank-wide commands by CmdTrace
+                int bank_id = addr_vec[int(T::Level::Bank)] +
+                              addr_vec[int(T::Level::Bank) - 1] *
+                                  cmd_trace_group_banks;
+                cmd_trace->record(clk, addr_vec[1], int(cmd), bank_id);
             }
             if (print_cmd_trace) {
                 printf("%5s %10ld:",
@@ -688,6 +1372,25 @@ namespace ramulator {
                 printf("\n");
             }
         }
+        // Invalidate the cached row hit state of the row groups whose rows
+        // cmd opens or closes
+        void update_bank_version(typename T::Command cmd,
+                                 const vector<int>& addr_vec) {
+            T* spec = channel->spec;
+            if (!(spec->is_opening(cmd) || spec->is_closing(cmd) ||
+                  spec->is_refreshing(cmd)))
+                return;
+
+            int scope = int(spec->scope[int(cmd)]);
+            if (spec->is_accessing(cmd))
+                scope = int(T::Level::Row) - 1;  // RDA and WRA
+
+            int first, num;
+            get_bank_range(scope, addr_vec, first, num);
+            for (int bank = first; bank < first + num; bank++)
+                bank_version[bank]++;
+        }
+
         vector<int> get_addr_vec(typename T::Command cmd,
                                  list<Request>::iterator req) {
             return req->addr_vec;
@@ -711,6 +1414,18 @@ namespace ramulator {
     void Controller<TLDRAM>::cmd_issue_autoprecharge(
         typename TLDRAM::Command& cmd, const vector<int>& addr_vec);
 
+    // SALP readiness and the TLDRAM tick don't follow the generic command
+    // timing, so these channels look for a command every cycle.
+    template <>
+    inline long Controller<SALP>::next_event() {
+        return clk + 1;
+    }
+
+    template <>
+    inline long Controller<TLDRAM>::next_event() {
+        return clk + 1;
+    }
+
 } /*namespace ramulator*/
 
 #endif /*__CONTROLLER_H*/
@@ -0,0 +1,108 @@
+#ifndef __EVENT_QUEUE_H
+#define __EVENT_QUEUE_H
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace ramulator {
+
+    // Timing wheel of events keyed on the cycle they become due. Events
+    // within `slots` cycles of the current cycle go to the bucket of their
+    // cycle, farther ones wait in an ordered overflow map. advance() moves
+    // the events that became due to the ready list in (cycle, insertion)
+    // order, so a tick only touches due events.
+    //
+    // Ready events stay in the ready list until the owner removes them,
+    // which lets a consumer keep an event it could not handle yet (e.g. a
+    // full memory queue) and retry it on the next tick.
+    template <typename T>
+    class EventQueue {
+    public:
+        typedef std::pair<long, T> Event;
+
+        explicit EventQueue(int slots = 256)
+            : buckets(slots), mask(slots - 1) {
+            assert((slots & (slots - 1)) == 0);
+        }
+
+        // Events due in a past cycle fire on the next advance.
+        void push(long when, T item) {
+            if (when <= now) {
+                when = now + 1;
+            }
+            count++;
+            if (when - now <= mask) {
+                buckets[when & mask].emplace_back(when, std::move(item));
+            } else {
+                overflow.emplace(when, std::move(item));
+            }
+        }
+
+        // Move all events due at or before clk to the ready list.
+        void advance(long clk) {
+            if (clk <= now) {
+                return;
+            }
+            // Overflow events were pushed before the bucketed events of
+            // the same cycle, so they go first
+            long last = std::min(clk, now + mask + 1);
+            for (long t = now + 1; t <= last; t++) {
+                auto it = overflow.begin();
+                while (it != overflow.end() && it->first == t) {
+                    ready.push_back(std::move(*it));
+                    it = overflow.erase(it);
+                }
+                auto& bucket = buckets[t & mask];
+                for (auto& event : bucket) {
+                    ready.push_back(std::move(event));
+                }
+                bucket.clear();
+            }
+            // After a jump of more than a whole wheel turn, the rest is
+            // only in the overflow map
+            while (!overflow.empty() && overflow.begin()->first <= clk) {
+                ready.push_back(std::move(*overflow.begin()));
+                overflow.erase(overflow.begin());
+            }
+            now = clk;
+        }
+
+        // Due events in order. Erase the handled ones with pop_ready().
+        std::vector<Event>& get_ready() { return ready; }
+
+        // Remove the ready events that handle() accepts, keeping the
+        // others in order. handle() may push new events.
+        template <typename F>
+        void pop_ready(F handle) {
+            size_t kept = 0;
+            for (size_t i = 0; i < ready.size(); i++) {
+                if (!handle(ready[i].second)) {
+                    if (kept != i) {
+                        ready[kept] = std::move(ready[i]);
+                    }
+                    kept++;
+                } else {
+                    count--;
+                }
+            }
+            ready.erase(ready.begin() + kept, ready.end());
+        }
+
+        bool empty() const { return count == 0; }
+        size_t size() const { return count; }
+
+    private:
+        std::vector<std::vector<Event>> buckets;
+        long mask;
+        std::multimap<long, T> overflow;
+        std::vector<Event> ready;
+        long now = 0;
+        size_t count = 0;
+    };
+
+}  // namespace ramulator
+
+#endif /* __EVENT_QUEUE_H */
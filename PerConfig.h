@@ -0,0 +1,30 @@
+#ifndef __PER_CONFIG_H
+#define __PER_CONFIG_H
+
+#include <map>
+#include <memory>
+#include <utility>
+
+#include "Config.h"
+
+namespace ramulator {
+
+    // The one X shared by the components built from configs, such as the
+    // controllers of every channel and the cache. It is made from args
+    // when first asked for, and lives as long as one of them holds it.
+    template <typename X, typename... Args>
+    std::shared_ptr<X> shared_per_config(const Config& configs,
+                                         Args&&... args) {
+        static std::map<const Config*, std::weak_ptr<X>> instances;
+        auto& instance = instances[&configs];
+        std::shared_ptr<X> shared = instance.lock();
+        if (!shared) {
+            shared = std::make_shared<X>(std::forward<Args>(args)...);
+            instance = shared;
+        }
+        return shared;
+    }
+
+}  // namespace ramulator
+
+#endif /* __PER_CONFIG_H */
@@ -0,0 +1,113 @@
+#include "Prefetcher.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+namespace ramulator {
+
+    const int Prefetcher::page_blocks_log;
+    const int Prefetcher::stride_entries;
+    const int Prefetcher::stream_entries;
+    const int Prefetcher::stream_window;
+    const int Prefetcher::stream_lag;
+    const long PrefetchTags::accuracy_window;
+
+    std::map<std::string, Prefetcher::Type> Prefetcher::name_to_type = {
+        {"none", Type::None},
+        {"stride", Type::Stride},
+        {"stream", Type::Stream},
+        {"all", Type::All},
+    };
+
+    Prefetcher::Prefetcher(Type type, int degree, int block_size, int cores)
+        : stride(type == Type::Stride || type == Type::All),
+          stream(type == Type::Stream || type == Type::All),
+          degree(degree),
+          stride_table(size_t(cores) * stride_entries),
+          stream_table(size_t(cores) * stream_entries) {
+        assert(degree > 0);
+        block_offset = 0;
+        while ((1 << block_offset) < block_size) block_offset++;
+    }
+
+    void Prefetcher::add(long block, long page, std::vector<long>& out) {
+        if (block >> page_blocks_log != page) return;
+        long addr = block << block_offset;
+        if (std::find(out.begin(), out.end(), addr) == out.end())
+            out.push_back(addr);
+    }
+
+    void Prefetcher::train(int core, long addr, std::vector<long>& out) {
+        long block = addr >> block_offset;
+        long page = block >> page_blocks_log;
+        accesses++;
+
+        if (stride) {
+            StrideEntry& entry = stride_table[size_t(core) * stride_entries +
+                                              page % stride_entries];
+            if (entry.page != page) {
+                entry.page = page;
+                entry.stride = 0;
+                entry.confidence = 0;
+            } else {
+                long delta = block - entry.last;
+                if (delta != 0 && delta == entry.stride) {
+                    entry.confidence = std::min(entry.confidence + 1, 3);
+                } else if (delta != 0) {
+                    entry.stride = delta;
+                    entry.confidence = 0;
+                }
+                if (entry.confidence >= 1) {
+                    for (int i = 1; i <= degree; i++)
+                        add(block + i * entry.stride, page, out);
+                }
+            }
+            entry.last = block;
+        }
+
+        if (stream) {
+            StreamEntry* trackers =
+                &stream_table[size_t(core) * stream_entries];
+            StreamEntry* tracker = nullptr;
+            StreamEntry* victim = trackers;
+            for (int i = 0; i < stream_entries; i++) {
+                StreamEntry& entry = trackers[i];
+                if (entry.last >= 0 &&
+                    std::abs(block - entry.last) <= stream_window) {
+                    tracker = &entry;
+                    break;
+                }
+                if (entry.lru < victim->lru) victim = &entry;
+            }
+
+            if (tracker == nullptr) {
+                *victim = StreamEntry();
+                victim->last = block;
+                victim->lru = accesses;
+                return;
+            }
+
+            tracker->lru = accesses;
+            long delta = block - tracker->last;
+            if (delta == 0) return;
+            if (tracker->dir != 0 && delta * tracker->dir < 0) {
+                // Misses of the stream served out of order land just
+                // behind its head and are ignored. Further back, the
+                // stream has turned around.
+                if (-delta * tracker->dir <= stream_lag) return;
+                tracker->dir = -tracker->dir;
+                tracker->trained = 0;
+            } else if (tracker->dir == 0) {
+                tracker->dir = delta > 0 ? 1 : -1;
+            } else {
+                tracker->trained++;
+            }
+            tracker->last = block;
+            if (tracker->trained >= 1) {
+                for (int i = 1; i <= degree; i++)
+                    add(tracker->last + i * tracker->dir, page, out);
+            }
+        }
+    }
+
+}  // namespace ramulator
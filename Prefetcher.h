@@ -0,0 +1,148 @@
+#ifndef __PREFETCHER_H
+#define __PREFETCHER_H
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "Config.h"
+#include "PerConfig.h"
+#include "Request.h"
+
+namespace ramulator {
+
+    // Prefetch engine of the last level cache. It is trained on the
+    // demand misses (and the demand hits on prefetched lines) of each
+    // core and returns the blocks to prefetch, never leaving the 4KB page
+    // of the access. Requests carry no PC, so both detectors work on
+    // addresses only:
+    // 1) Stride - per page, the distance between the last two accesses;
+    //             once the same stride is seen twice in a row, the next
+    //             degree blocks along it are prefetched
+    // 2) Stream - trackers of windows of blocks missed in one direction;
+    //             after two misses in the same direction, the degree
+    //             blocks ahead of the stream are prefetched. Misses
+    //             reordered a few blocks behind the head are ignored.
+    //
+    // Config options:
+    //   prefetcher      - none (default), stride, stream or all
+    //   prefetch_degree - blocks prefetched per trained access (default 2)
+    class Prefetcher {
+    public:
+        enum class Type { None, Stride, Stream, All, MAX };
+
+        static std::map<std::string, Type> name_to_type;
+
+        Prefetcher(Type type, int degree, int block_size, int cores);
+
+        // Train on an access of core and append the block addresses to
+        // prefetch to out
+        void train(int core, long addr, std::vector<long>& out);
+
+    private:
+        static const int page_blocks_log = 6;  // 4KB pages of 64B blocks
+        static const int stride_entries = 64;  // per core
+        static const int stream_entries = 16;  // per core
+        static const int stream_window = 16;   // blocks
+        static const int stream_lag = 4;  // blocks behind the head ignored
+
+        struct StrideEntry {
+            long page = -1;
+            long last = 0;  // block
+            long stride = 0;
+            int confidence = 0;
+        };
+
+        struct StreamEntry {
+            long last = -1;  // furthest block of the stream
+            int dir = 0;
+            int trained = 0;
+            long lru = 0;
+        };
+
+        bool stride;
+        bool stream;
+        int degree;
+        int block_offset;
+        long accesses = 0;
+
+        std::vector<StrideEntry> stride_table;  // per core, by page
+        std::vector<StreamEntry> stream_table;  // per core
+
+        void add(long block, long page, std::vector<long>& out);
+    };
+
+    // Block addresses of the prefetches in flight to memory. One set is
+    // shared by the last level cache and the memory controllers built from
+    // the same Config, so that the controllers can tell prefetches from
+    // demand reads. A prefetch leaves the set when its data arrives, when
+    // it is dropped, or when a demand request merges into it. The set also
+    // keeps the prefetch accuracy of each core, over about its last
+    // accuracy_window prefetches.
+    class PrefetchTags {
+    public:
+        static std::shared_ptr<PrefetchTags> get(const Config& configs) {
+            return shared_per_config<PrefetchTags>(configs);
+        }
+
+        // Gives up a prefetch queued in memory, set by the cache
+        std::function<bool(const Request&)> drop;
+
+        // A prefetch of core to addr is sent to memory
+        void insert(long addr, int core) {
+            addrs.insert(addr);
+            Counts& counts = core_counts(core);
+            if (++counts.issued == 2 * accuracy_window) {
+                counts.issued /= 2;
+                counts.useful /= 2;
+            }
+        }
+        void erase(long addr) { addrs.erase(addr); }
+
+        // A demand request merged into the prefetch to addr, which memory
+        // now serves as a demand read. The controllers refresh the
+        // prefetch bits of their queues when promotions changes.
+        void promote(long addr) {
+            addrs.erase(addr);
+            promotions++;
+        }
+        long promotions = 0;
+        bool contains(long addr) const {
+            return !addrs.empty() && addrs.count(addr);
+        }
+
+        // A prefetch of core was used by a demand request
+        void use(int core) { core_counts(core).useful++; }
+
+        // Useful prefetches per prefetch of core, 1 before any is issued
+        double accuracy(int core) const {
+            if (size_t(core) >= counts.size() || counts[core].issued == 0)
+                return 1.0;
+            return std::min(1.0, double(counts[core].useful) /
+                                     counts[core].issued);
+        }
+
+    private:
+        static const long accuracy_window = 256;
+
+        struct Counts {
+            long issued = 0;
+            long useful = 0;
+        };
+
+        std::unordered_set<long> addrs;
+        std::vector<Counts> counts;  // per core
+
+        Counts& core_counts(int core) {
+            if (size_t(core) >= counts.size()) counts.resize(core + 1);
+            return counts[core];
+        }
+    };
+
+}  // namespace ramulator
+
+#endif /* __PREFETCHER_H */
@@ -0,0 +1,242 @@
+#include "ReplacementPolicy.h"
+#include <algorithm>
+
+namespace ramulator {
+
+    const uint8_t RRIPPolicy::max_rrpv;
+    const int RRIPPolicy::bimodal_throttle;
+    const int RRIPPolicy::leader_sets;
+    const int RRIPPolicy::psel_max;
+    const int SHiPPolicy::shct_bits;
+    const uint8_t SHiPPolicy::shct_max;
+    const int SHiPPolicy::region_offset;
+
+    std::map<std::string, ReplacementPolicy::Type>
+        ReplacementPolicy::name_to_policy = {
+            {"LRU", Type::LRU},     {"PLRU", Type::PLRU},
+            {"SRRIP", Type::SRRIP}, {"BRRIP", Type::BRRIP},
+            {"DRRIP", Type::DRRIP}, {"SHiP", Type::SHiP},
+    };
+
+    ReplacementPolicy* ReplacementPolicy::create(Type type, int sets,
+                                                 int assoc) {
+        switch (type) {
+            case Type::PLRU:
+                return new PLRUPolicy(sets, assoc);
+            case Type::SRRIP:
+                return new RRIPPolicy(sets, assoc,
+                                      RRIPPolicy::Insertion::Static);
+            case Type::BRRIP:
+                return new RRIPPolicy(sets, assoc,
+                                      RRIPPolicy::Insertion::Bimodal);
+            case Type::DRRIP:
+                return new RRIPPolicy(sets, assoc,
+                                      RRIPPolicy::Insertion::Dueling);
+            case Type::SHiP:
+                return new SHiPPolicy(sets, assoc);
+            default:
+                return new LRUPolicy(sets, assoc);
+        }
+    }
+
+    /* LRU */
+
+    LRUPolicy::LRUPolicy(int sets, int assoc)
+        : ReplacementPolicy(sets, assoc), rank(size_t(sets) * assoc) {
+        for (size_t i = 0; i < rank.size(); i++) {
+            rank[i] = uint8_t(i % assoc);
+        }
+    }
+
+    void LRUPolicy::hit(int set, int way, const Request& req) {
+        touch(set, way);
+    }
+
+    void LRUPolicy::insert(int set, int way, const Request& req) {
+        touch(set, way);
+    }
+
+    void LRUPolicy::touch(int set, int way) {
+        uint8_t* ranks = &rank[size_t(set) * assoc];
+        uint8_t old = ranks[way];
+        for (int w = 0; w < assoc; w++) {
+            if (ranks[w] < old) {
+                ranks[w]++;
+            }
+        }
+        ranks[way] = 0;
+    }
+
+    int LRUPolicy::victim(int set, uint64_t candidates) {
+        const uint8_t* ranks = &rank[size_t(set) * assoc];
+        int victim = -1;
+        for (int w = 0; w < assoc; w++) {
+            if (((candidates >> w) & 1) &&
+                (victim < 0 || ranks[w] > ranks[victim])) {
+                victim = w;
+            }
+        }
+        assert(victim >= 0);
+        return victim;
+    }
+
+    /* Tree PLRU */
+
+    PLRUPolicy::PLRUPolicy(int sets, int assoc)
+        : ReplacementPolicy(sets, assoc), tree(sets, 0) {}
+
+    void PLRUPolicy::hit(int set, int way, const Request& req) {
+        touch(set, way);
+    }
+
+    void PLRUPolicy::insert(int set, int way, const Request& req) {
+        touch(set, way);
+    }
+
+    void PLRUPolicy::touch(int set, int way) {
+        // Point every node on the path away from the accessed way
+        uint64_t& bits = tree[set];
+        int node = 1, lo = 0, hi = assoc;
+        while (hi - lo > 1) {
+            int mid = (lo + hi) / 2;
+            if (way < mid) {
+                bits |= (1ull << node);
+                node = node * 2;
+                hi = mid;
+            } else {
+                bits &= ~(1ull << node);
+                node = node * 2 + 1;
+                lo = mid;
+            }
+        }
+    }
+
+    int PLRUPolicy::victim(int set, uint64_t candidates) {
+        // Follow the tree bits, but never descend into a half without
+        // candidates
+        uint64_t bits = tree[set];
+        int node = 1, lo = 0, hi = assoc;
+        while (hi - lo > 1) {
+            int mid = (lo + hi) / 2;
+            uint64_t left = (candidates >> lo) & ((1ull << (mid - lo)) - 1);
+            uint64_t right = (candidates >> mid) & ((1ull << (hi - mid)) - 1);
+            bool go_right = (bits >> node) & 1;
+            if (go_right ? !right : !left) {
+                go_right = !go_right;
+            }
+            if (go_right) {
+                node = node * 2 + 1;
+                lo = mid;
+            } else {
+                node = node * 2;
+                hi = mid;
+            }
+        }
+        assert((candidates >> lo) & 1);
+        return lo;
+    }
+
+    /* SRRIP, BRRIP and DRRIP */
+
+    RRIPPolicy::RRIPPolicy(int sets, int assoc, Insertion insertion)
+        : ReplacementPolicy(sets, assoc),
+          insertion(insertion),
+          rrpv(size_t(sets) * assoc, max_rrpv) {
+        leader_stride = std::max(2, sets / leader_sets);
+    }
+
+    void RRIPPolicy::hit(int set, int way, const Request& req) {
+        rrpv[size_t(set) * assoc + way] = 0;
+    }
+
+    void RRIPPolicy::touch(int set, int way) {
+        rrpv[size_t(set) * assoc + way] = 0;
+    }
+
+    void RRIPPolicy::insert(int set, int way, const Request& req) {
+        rrpv[size_t(set) * assoc + way] = insert_rrpv(set);
+    }
+
+    uint8_t RRIPPolicy::insert_rrpv(int set) {
+        bool bimodal = (insertion == Insertion::Bimodal);
+        if (insertion == Insertion::Dueling) {
+            // Every fill is a miss. A miss in a leader set votes against
+            // its policy, followers use the policy that misses less.
+            if (set % leader_stride == 0) {
+                psel = std::min(psel + 1, psel_max);
+                bimodal = false;
+            } else if (set % leader_stride == 1) {
+                psel = std::max(psel - 1, 0);
+                bimodal = true;
+            } else {
+                bimodal = (psel > psel_max / 2);
+            }
+        }
+        if (!bimodal) {
+            return max_rrpv - 1;
+        }
+        if (++bimodal_count == bimodal_throttle) {
+            bimodal_count = 0;
+            return max_rrpv - 1;
+        }
+        return max_rrpv;
+    }
+
+    int RRIPPolicy::victim(int set, uint64_t candidates) {
+        uint8_t* rrpvs = &rrpv[size_t(set) * assoc];
+        while (true) {
+            for (int w = 0; w < assoc; w++) {
+                if (((candidates >> w) & 1) && rrpvs[w] >= max_rrpv) {
+                    return w;
+                }
+            }
+            // No distant line, age the whole set
+            for (int w = 0; w < assoc; w++) {
+                if (rrpvs[w] < max_rrpv) {
+                    rrpvs[w]++;
+                }
+            }
+        }
+    }
+
+    /* SHiP */
+
+    SHiPPolicy::SHiPPolicy(int sets, int assoc)
+        : RRIPPolicy(sets, assoc, Insertion::Static),
+          shct(1 << shct_bits, 1),
+          signature(size_t(sets) * assoc, 0),
+          reused(size_t(sets) * assoc, false) {}
+
+    void SHiPPolicy::hit(int set, int way, const Request& req) {
+        size_t i = size_t(set) * assoc + way;
+        rrpv[i] = 0;
+        if (!reused[i]) {
+            reused[i] = true;
+            uint8_t& counter = shct[signature[i]];
+            if (counter < shct_max) {
+                counter++;
+            }
+        }
+    }
+
+    void SHiPPolicy::insert(int set, int way, const Request& req) {
+        size_t i = size_t(set) * assoc + way;
+        signature[i] = get_signature(req);
+        reused[i] = false;
+        // Lines of signatures that never see reuse are inserted at
+        // distant re-reference
+        rrpv[i] = shct[signature[i]] == 0 ? max_rrpv : max_rrpv - 1;
+    }
+
+    void SHiPPolicy::evict(int set, int way) {
+        size_t i = size_t(set) * assoc + way;
+        if (!reused[i]) {
+            uint8_t& counter = shct[signature[i]];
+            if (counter > 0) {
+                counter--;
+            }
+        }
+        reused[i] = true;  // don't train twice for the same fill
+    }
+
+}  // namespace ramulator
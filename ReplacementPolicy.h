@@ -0,0 +1,143 @@
+#ifndef __REPLACEMENT_POLICY_H
+#define __REPLACEMENT_POLICY_H
+
+#include "Request.h"
+#include <cassert>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ramulator {
+
+    // Replacement policies of the cache tag store. A policy only sees set
+    // and way numbers and keeps its own compact per-set metadata; the
+    // cache tells it about hits, fills and evictions and asks it for a
+    // victim among the ways that are allowed to be replaced.
+    //
+    // Current policies:
+    // 1) LRU   - Least recently used, one recency rank per way
+    // 2) PLRU  - Tree pseudo-LRU, assoc - 1 direction bits per set
+    // 3) SRRIP - Static re-reference interval prediction, 2-bit RRPV
+    // 4) BRRIP - Bimodal RRIP, inserts mostly at distant re-reference
+    // 5) DRRIP - Set dueling between SRRIP and BRRIP
+    // 6) SHiP  - Signature-based hit predictor on top of SRRIP. Requests
+    //            carry no PC, so the signature is the memory region of
+    //            the line (SHiP-Mem) hashed with the requesting core.
+    class ReplacementPolicy {
+    public:
+        enum class Type { LRU, PLRU, SRRIP, BRRIP, DRRIP, SHiP, MAX };
+
+        static std::map<std::string, Type> name_to_policy;
+
+        static ReplacementPolicy* create(Type type, int sets, int assoc);
+
+        ReplacementPolicy(int sets, int assoc) : sets(sets), assoc(assoc) {
+            assert(assoc <= 64);
+        }
+        virtual ~ReplacementPolicy() {}
+
+        // A demand request hits the line in way.
+        virtual void hit(int set, int way, const Request& req) = 0;
+
+        // A new line for req is filled into way.
+        virtual void insert(int set, int way, const Request& req) = 0;
+
+        // The line is written back from a higher level and is promoted
+        // without training the policy.
+        virtual void touch(int set, int way) = 0;
+
+        // The line in way leaves the cache.
+        virtual void evict(int set, int way) {}
+
+        // Choose the victim among the ways whose bit is set in candidates.
+        // candidates must not be empty.
+        virtual int victim(int set, uint64_t candidates) = 0;
+
+    protected:
+        int sets;
+        int assoc;
+    };
+
+    class LRUPolicy : public ReplacementPolicy {
+    public:
+        LRUPolicy(int sets, int assoc);
+        void hit(int set, int way, const Request& req) override;
+        void insert(int set, int way, const Request& req) override;
+        void touch(int set, int way) override;
+        int victim(int set, uint64_t candidates) override;
+
+    private:
+        // Recency rank of every way, 0 is MRU and assoc - 1 is LRU.
+        std::vector<uint8_t> rank;
+    };
+
+    class PLRUPolicy : public ReplacementPolicy {
+    public:
+        PLRUPolicy(int sets, int assoc);
+        void hit(int set, int way, const Request& req) override;
+        void insert(int set, int way, const Request& req) override;
+        void touch(int set, int way) override;
+        int victim(int set, uint64_t candidates) override;
+
+    private:
+        // Heap ordered tree bits of each set, node 1 is the root. A bit
+        // points to the half that should be replaced next (0 is left).
+        std::vector<uint64_t> tree;
+    };
+
+    class RRIPPolicy : public ReplacementPolicy {
+    public:
+        enum class Insertion { Static, Bimodal, Dueling };
+
+        RRIPPolicy(int sets, int assoc, Insertion insertion);
+        void hit(int set, int way, const Request& req) override;
+        void insert(int set, int way, const Request& req) override;
+        void touch(int set, int way) override;
+        int victim(int set, uint64_t candidates) override;
+
+    protected:
+        static const uint8_t max_rrpv = 3;  // 2-bit RRPV
+        static const int bimodal_throttle = 32;
+        static const int leader_sets = 32;
+        static const int psel_max = 1023;  // 10-bit policy selector
+
+        Insertion insertion;
+        std::vector<uint8_t> rrpv;
+        int bimodal_count = 0;
+        int psel = psel_max / 2;
+        int leader_stride;
+
+        // Re-reference prediction of a newly filled line
+        uint8_t insert_rrpv(int set);
+    };
+
+    class SHiPPolicy : public RRIPPolicy {
+    public:
+        SHiPPolicy(int sets, int assoc);
+        void hit(int set, int way, const Request& req) override;
+        void insert(int set, int way, const Request& req) override;
+        void evict(int set, int way) override;
+
+    private:
+        static const int shct_bits = 14;
+        static const uint8_t shct_max = 3;  // 2-bit counters
+        static const int region_offset = 14;  // 16KB memory regions
+
+        // Signature history counter table
+        std::vector<uint8_t> shct;
+        // Per way signature and whether the line was reused
+        std::vector<uint16_t> signature;
+        std::vector<bool> reused;
+
+        uint16_t get_signature(const Request& req) {
+            long region = req.addr >> region_offset;
+            long hash = region ^ (region >> shct_bits) ^
+                        (long(req.coreid) << (shct_bits - 4));
+            return uint16_t(hash & ((1 << shct_bits) - 1));
+        }
+    };
+
+}  // namespace ramulator
+
+#endif /* __REPLACEMENT_POLICY_H */
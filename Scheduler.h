@@ -22,6 +22,14 @@ Current Memory Scheduling Policies:
         are ready, they they are scheduled chronologically. Otherwise, it
         behaves the same way as FCFSBank.
 
+4) PADC - Prefetch-Aware DRAM Controller
+        Demand reads, and the prefetches of cores whose prefetches are
+        accurate, are critical and scheduled before the other prefetches.
+        Then FRFCFS, with the demand reads of the cores whose prefetches
+        are inaccurate (urgent) first among equally ready requests. When
+        the read queue fills, prefetches that waited longer than the
+        accuracy of their core allows are dropped.
+
                 _______________________________________
 
 Current Row Policies:
@@ -33,7 +41,7 @@ Current Row Policies:
               other rows.
 4) Timeout  - Precharges a row after X time if there are no pending references.
               'X' time can be changed by changing the variable timeout
-              on line number 267
+              in RowPolicy
 
 *****************************************************************************/
 
@@ -44,10 +52,10 @@ Current Row Policies:
 #include "Request.h"
 #include "Controller.h"
 #include "Config.h"  // Saugata
+#include <algorithm>
 #include <vector>
 #include <map>
 #include <list>
-#include <functional>
 #include <cassert>
 
 using namespace std;
@@ -63,14 +71,25 @@ namespace ramulator {
         Controller<T>* ctrl;
 
         // 18-740
-        enum class Type { FCFS, FCFSBank, FRFCFS, BLISS, Custom, MAX } type;
+        enum class Type {
+            FCFS,
+            FCFSBank,
+            FRFCFS,
+            BLISS,
+            Custom,
+            PADC,
+            MAX
+        } type;
 
         std::map<string, Type> name_to_scheduler = {
             {"FCFS", Type::FCFS},     {"FCFSBank", Type::FCFSBank},
             {"FRFCFS", Type::FRFCFS}, {"BLISS", Type::BLISS},
-            {"Custom", Type::Custom},
+            {"Custom", Type::Custom}, {"PADC", Type::PADC},
         };
 
+        typedef typename Controller<T>::Queue Queue;
+        typedef typename Queue::Entry Entry;
+
         // Saugata
         Scheduler(const Config& configs, Controller<T>* ctrl) : ctrl(ctrl) {
             // Initiating scheduler
@@ -79,126 +98,223 @@ namespace ramulator {
             } else {
                 type = Type::FRFCFS;
             }
+
+            switch (type) {
+                case Type::FCFS:
+                    bind<FCFSCompare>();
+                    break;
+                case Type::FCFSBank:
+                    bind<FCFSBankCompare>();
+                    break;
+                case Type::BLISS:
+                    bind<BLISSCompare>();
+                    break;
+                case Type::Custom:
+                    bind<CustomCompare>();
+                    break;
+                case Type::PADC:
+                    bind<PADCCompare>();
+                    break;
+                default:
+                    bind<FRFCFSCompare>();
+                    break;
+            }
+        }
+
+        list<Request>::iterator get_head(Queue& queue) {
+            return (this->*queue_head)(queue);
         }
 
         list<Request>::iterator get_head(list<Request>& q) {
-            // TODO make the decision at compile time
-            if (type == Type::FCFS || type == Type::FCFSBank) {  // 18-740
-                // If queue is empty, return end of queue
-                if (!q.size()) return q.end();
-
-                // Else return based on the policy
-                auto head = q.begin();
-                for (auto itr = next(q.begin(), 1); itr != q.end(); itr++)
-                    head = compare[int(type)](head, itr);
-
-                return head;
-            } else {  // Code to get around edge cases for FRFCFS
-
-                // If queue is empty, return end of queue
-                if (!q.size()) return q.end();
-
-                // Else return based on FRFCFS Scheduling Policy
-                auto head = q.begin();
-                for (auto itr = next(q.begin(), 1); itr != q.end(); itr++) {
-                    head = compare[int(type)](head, itr);
-                }
+            return (this->*list_head)(q);
+        }
+
+    private:
+        // Requests are compared through their queue entries, which carry
+        // the readiness and row hit state of the request
+        typedef const Entry* ReqIter;
+
+        vector<const Entry*> heads;  // best request of each bank
+        vector<bool> hit_groups;     // row groups of a plain request list
+                                     // with row hits
+        vector<Entry> entries;       // entries of a plain request list
+
+        // The scheduler is chosen once, and its compare function is
+        // inlined into these loops
+        list<Request>::iterator (Scheduler::*queue_head)(Queue&);
+        list<Request>::iterator (Scheduler::*list_head)(list<Request>&);
+
+        template <typename Compare>
+        void bind() {
+            queue_head = &Scheduler::get_queue_head<Compare>;
+            list_head = &Scheduler::get_list_head<Compare>;
+        }
 
-                if (this->ctrl->is_ready(head) &&
-                    this->ctrl->is_row_hit(head)) {
-                    return head;
+        template <typename Compare>
+        list<Request>::iterator get_queue_head(Queue& queue) {
+            if (!queue.indexed) return get_list_head<Compare>(queue.q);
+
+            // If queue is empty, return end of queue
+            if (!queue.size()) return queue.q.end();
+
+            ctrl->update_entries(queue);
+            Compare compare{ctrl};
+
+            // Compare the best request of each bank. Each bank list and the
+            // final pass are in queue order, so this picks the same request
+            // as comparing the whole queue.
+            heads.clear();
+            for (int bank : queue.active) {
+                auto& entries = queue.banks[bank];
+                const Entry* head = &entries[0];
+                for (size_t i = 1; i < entries.size(); i++)
+                    head = compare(head, &entries[i]);
+                heads.push_back(head);
+            }
+            const Entry* head = get_heads_head(compare);
+
+            if (!Compare::protect_hits || (head->ready && head->hit))
+                return head->req;
+
+            // Code to get around edge cases for FRFCFS: don't close a row
+            // that other requests hit. PRE closes pre_group_size banks.
+            int group_size = ctrl->pre_group_size;
+            FCFSBankCompare bank_compare{ctrl};
+
+            heads.clear();
+            for (int bank : queue.active) {
+                bool hit_group = queue.group_hits[bank / group_size] > 0;
+                const Entry* head = nullptr;
+                for (auto& entry : queue.banks[bank]) {
+                    // so the next instruction to be scheduled is PRE, might
+                    // violate hit
+                    if (hit_group && !entry.hit && entry.open) continue;
+                    head = head ? bank_compare(head, &entry) : &entry;
                 }
+                if (head) heads.push_back(head);
+            }
+            // if we can't find proper request, we need to return q.end(),
+            // so that no command will be scheduled
+            if (heads.empty()) return queue.q.end();
+            return get_heads_head(bank_compare)->req;
+        }
 
-                // prepare a list of hit request
-                vector<vector<int>> hit_reqs;
-                for (auto itr = q.begin(); itr != q.end(); ++itr) {
-                    if (this->ctrl->is_row_hit(itr)) {
-                        auto begin = itr->addr_vec.begin();
-                        // TODO Here it assumes all DRAM standards use PRE to
-                        // close a row It's better to make it more general.
-                        auto end = begin +
-                                   int(ctrl->channel->spec
-                                           ->scope[int(T::Command::PRE)]) +
-                                   1;
-                        vector<int> rowgroup(begin, end);  // bank or subarray
-                        hit_reqs.push_back(rowgroup);
-                    }
+        template <typename Compare>
+        list<Request>::iterator get_list_head(list<Request>& q) {
+            // If queue is empty, return end of queue
+            if (!q.size()) return q.end();
+
+            entries.clear();
+            long seq = 0;
+            for (auto itr = q.begin(); itr != q.end(); ++itr) {
+                entries.push_back({itr, -1, seq++, 0,
+                                   this->ctrl->is_row_hit(itr),
+                                   this->ctrl->is_row_open(itr),
+                                   this->ctrl->is_ready(itr),
+                                   this->ctrl->is_prefetch(*itr)});
+            }
+
+            Compare compare{ctrl};
+            const Entry* head = &entries[0];
+            for (size_t i = 1; i < entries.size(); i++)
+                head = compare(head, &entries[i]);
+
+            if (!Compare::protect_hits || (head->ready && head->hit)) {
+                return head->req;
+            }
+
+            // Code to get around edge cases for FRFCFS
+
+            // mark the row groups of hit requests. A row group is the
+            // index of its banks divided by the number of banks a PRE
+            // closes
+            int group_size = ctrl->pre_group_size;
+            hit_groups.assign(ctrl->bank_num / group_size, false);
+            for (auto& entry : entries) {
+                if (entry.hit)
+                    hit_groups[ctrl->get_bank(entry.req->addr_vec) /
+                               group_size] = true;
+            }
+            // if we can't find proper request, we need to return q.end(),
+            // so that no command will be scheduled
+            FCFSBankCompare bank_compare{ctrl};
+            head = nullptr;
+            for (auto& entry : entries) {
+                // so the next instruction to be scheduled is PRE, might
+                // violate hit
+                if ((!entry.hit) && entry.open &&
+                    hit_groups[ctrl->get_bank(entry.req->addr_vec) /
+                               group_size]) {
+                    continue;
                 }
-                // if we can't find proper request, we need to return q.end(),
-                // so that no command will be scheduled
-                head = q.end();
-                for (auto itr = q.begin(); itr != q.end(); itr++) {
-                    bool violate_hit = false;
-                    if ((!this->ctrl->is_row_hit(itr)) &&
-                        this->ctrl->is_row_open(itr)) {
-                        // so the next instruction to be scheduled is PRE, might
-                        // violate hit
-                        auto begin = itr->addr_vec.begin();
-                        // TODO Here it assumes all DRAM standards use PRE to
-                        // close a row It's better to make it more general.
-                        auto end = begin +
-                                   int(ctrl->channel->spec
-                                           ->scope[int(T::Command::PRE)]) +
-                                   1;
-                        vector<int> rowgroup(begin, end);  // bank or subarray
-                        for (const auto& hit_req_rowgroup : hit_reqs) {
-                            if (rowgroup == hit_req_rowgroup) {
-                                violate_hit = true;
-                                break;
-                            }
-                        }
-                    }
-                    if (violate_hit) {
-                        continue;
-                    }
-                    // If it comes here, that means it won't violate any hit
-                    // request
-                    if (head == q.end()) {
-                        head = itr;
-                    } else {
-                        head = compare[int(Type::FCFSBank)](head, itr);
-                    }
+                // If it comes here, that means it won't violate any hit
+                // request
+                if (!head) {
+                    head = &entry;
+                } else {
+                    head = bank_compare(head, &entry);
                 }
-
-                return head;
             }
+
+            return head ? head->req : q.end();
         }
 
-        // Compare functions for each memory schedulers
-    private:
-        typedef list<Request>::iterator ReqIter;
-        function<ReqIter(ReqIter, ReqIter)> compare[int(Type::MAX)] = {
-            // FCFS
-            [this](ReqIter req1, ReqIter req2) {
+        template <typename Compare>
+        const Entry* get_heads_head(Compare& compare) {
+            sort(heads.begin(), heads.end(),
+                 [](const Entry* a, const Entry* b) {
+                     return a->seq < b->seq;
+                 });
+            const Entry* head = heads[0];
+            for (size_t i = 1; i < heads.size(); i++)
+                head = compare(head, heads[i]);
+            return head;
+        }
+
+        // Compare functions for each memory schedulers. Each returns the
+        // request to schedule first, and req1, which is the earlier one in
+        // the queue, on a tie.
+
+        // FCFS
+        struct FCFSCompare {
+            static const bool protect_hits = false;
+            Controller<T>* ctrl;
+            ReqIter operator()(ReqIter req1, ReqIter req2) {
                 // return the request with the oldest (i.e., smallest) arrival
                 // time
-                if (req1->arrive <= req2->arrive) return req1;
+                if (req1->req->arrive <= req2->req->arrive) return req1;
                 return req2;
-            },
+            }
+        };
 
-            // FCFSBank
-            [this](ReqIter req1, ReqIter req2) {
-                bool ready1 = this->ctrl->is_ready(req1);
-                bool ready2 = this->ctrl->is_ready(req2);
+        // FCFSBank
+        struct FCFSBankCompare {
+            static const bool protect_hits = false;
+            Controller<T>* ctrl;
+            ReqIter operator()(ReqIter req1, ReqIter req2) {
+                bool ready1 = req1->ready;
+                bool ready2 = req2->ready;
 
                 if (ready1 ^ ready2) {
                     if (ready1) return req1;
                     return req2;
                 }
 
-                if (req1->arrive <= req2->arrive) return req1;
+                if (req1->req->arrive <= req2->req->arrive) return req1;
                 return req2;
-            },
+            }
+        };
 
-            // FRFCFS
-            [this](ReqIter req1, ReqIter req2) {
+        // FRFCFS
+        struct FRFCFSCompare {
+            static const bool protect_hits = true;
+            Controller<T>* ctrl;
+            ReqIter operator()(ReqIter req1, ReqIter req2) {
                 // for each request, check if:
                 // - the bank is idle (is_ready()), and
                 // - if the requeest is a row hit (is_row_hit())
-                bool ready1 =
-                    this->ctrl->is_ready(req1) && this->ctrl->is_row_hit(req1);
-                bool ready2 =
-                    this->ctrl->is_ready(req2) && this->ctrl->is_row_hit(req2);
+                bool ready1 = req1->ready && req1->hit;
+                bool ready2 = req2->ready && req2->hit;
 
                 // check if one is true and one is false
                 if (ready1 ^ ready2) {
@@ -210,19 +326,25 @@ namespace ramulator {
 
                 // if both are true or both are false, break ties by arrival
                 // time (smaller = older)
-                if (req1->arrive <= req2->arrive) return req1;
+                if (req1->req->arrive <= req2->req->arrive) return req1;
                 return req2;
-            },
+            }
+        };
 
-            // 18-740: Add your BLISS scheduler comparison here
-            // BLISS
-            [this](ReqIter req1, ReqIter req2) {
+        // 18-740: Add your BLISS scheduler comparison here
+        // BLISS
+        struct BLISSCompare {
+            static const bool protect_hits = true;
+            Controller<T>* ctrl;
+            ReqIter operator()(ReqIter req1, ReqIter req2) {
                 // 18-740: ADD CODE BELOW THIS LINE
                 //
                 // SOME TIPS
-                // - Treat the iterator object (ReqIter) like a pointer
+                // - ReqIter points to the queue entry of a request; the
+                //     request itself is req1->req, and req1->ready and
+                //     req1->hit hold its is_ready() and is_row_hit()
                 // - To determine which core generated a request, use:
-                // req1->coreid
+                // req1->req->coreid
                 // - To access a variable inside the controller object, access
                 // it
                 //     through the this->ctrl pointer (e.g., to access the
@@ -232,37 +354,71 @@ namespace ramulator {
                 // Prioritizing blacklisting
                 if (
                     // If the first core is blacklisted, and the second is not
-                    this->ctrl->bStatus[req1->coreid] &&
-                    !this->ctrl->bStatus[req2->coreid]) {
+                    this->ctrl->is_blacklisted(req1->req->coreid) &&
+                    !this->ctrl->is_blacklisted(req2->req->coreid)) {
                     // Prioritize the second core
                     return req2;
                 } else if (
                     // If the second core is blacklisted, and the first is not
-                    this->ctrl->bStatus[req2->coreid] &&
-                    !this->ctrl->bStatus[req1->coreid]) {
+                    this->ctrl->is_blacklisted(req2->req->coreid) &&
+                    !this->ctrl->is_blacklisted(req1->req->coreid)) {
                     // Prioritize the first core
                     return req1;
                 }
 
                 // * FR-FCFS scheduling
-                bool ready1 =
-                    this->ctrl->is_ready(req1) && this->ctrl->is_row_hit(req1);
-                bool ready2 =
-                    this->ctrl->is_ready(req2) && this->ctrl->is_row_hit(req2);
+                bool ready1 = req1->ready && req1->hit;
+                bool ready2 = req2->ready && req2->hit;
 
                 if (ready1 ^ ready2) {
                     if (ready1) return req1;
                     return req2;
                 }
 
-                if (req1->arrive <= req2->arrive) return req1;
+                if (req1->req->arrive <= req2->req->arrive) return req1;
                 return req2;
                 // 18-740: ADD CODE ABOVE THIS LINE
-            },
+            }
+        };
+
+        // PADC
+        struct PADCCompare {
+            static const bool protect_hits = true;
+            Controller<T>* ctrl;
+            ReqIter operator()(ReqIter req1, ReqIter req2) {
+                // Prefetches of inaccurate cores go last
+                bool critical1 = this->ctrl->is_critical(*req1);
+                bool critical2 = this->ctrl->is_critical(*req2);
+                if (critical1 ^ critical2) {
+                    if (critical1) return req1;
+                    return req2;
+                }
 
-            // 18-740: Add your Custom scheduler comparison here
-            // Custom
-            [this](ReqIter req1, ReqIter req2) {
+                bool ready1 = req1->ready && req1->hit;
+                bool ready2 = req2->ready && req2->hit;
+                if (ready1 ^ ready2) {
+                    if (ready1) return req1;
+                    return req2;
+                }
+
+                bool urgent1 = this->ctrl->is_urgent(*req1);
+                bool urgent2 = this->ctrl->is_urgent(*req2);
+                if (urgent1 ^ urgent2) {
+                    if (urgent1) return req1;
+                    return req2;
+                }
+
+                if (req1->req->arrive <= req2->req->arrive) return req1;
+                return req2;
+            }
+        };
+
+        // 18-740: Add your Custom scheduler comparison here
+        // Custom
+        struct CustomCompare {
+            static const bool protect_hits = true;
+            Controller<T>* ctrl;
+            ReqIter operator()(ReqIter req1, ReqIter req2) {
                 // 18-740: ADD CODE BELOW THIS LINE
 
                 // * BLISS SCHEDULER
@@ -270,36 +426,35 @@ namespace ramulator {
                 // Prioritizing non-blacklisted threads
                 if (
                     // If the first core is blacklisted, and the second is not
-                    this->ctrl->bStatus[req1->coreid] &&
-                    !this->ctrl->bStatus[req2->coreid]) {
+                    this->ctrl->is_blacklisted(req1->req->coreid) &&
+                    !this->ctrl->is_blacklisted(req2->req->coreid)) {
                     // Prioritize the second core
                     return req2;
                 } else if (
                     // If the second core is blacklisted, and the first is not
-                    this->ctrl->bStatus[req2->coreid] &&
-                    !this->ctrl->bStatus[req1->coreid]) {
+                    this->ctrl->is_blacklisted(req2->req->coreid) &&
+                    !this->ctrl->is_blacklisted(req1->req->coreid)) {
                     // Prioritize the first core
                     return req1;
                 }
 
                 // Important: If all cores are blacklisted, then un-blacklist
                 //  all of them at once
-                if (this->ctrl->bStatus[0] && this->ctrl->bStatus[1] &&
-                    this->ctrl->bStatus[2] && this->ctrl->bStatus[3]) {
+                auto& blacklist = this->ctrl->blacklist;
+                if (blacklist->bStatus == blacklist->all_cores) {
                     // This makes BLISS more aggressive in blacklisting
-                    this->ctrl->bStatus[0] = false;
-                    this->ctrl->bStatus[1] = false;
-                    this->ctrl->bStatus[2] = false;
-                    this->ctrl->bStatus[3] = false;
+                    blacklist->bStatus = 0;
                     // Also reset this so we don't instantly blacklist a core
-                    this->ctrl->numRequests = 0;
+                    blacklist->numRequests = 0;
                 }
 
                 // * EQUITY SCHEDULER
 
                 // Get the number of requests
-                long req1Count = this->ctrl->numRequestsPerCore[req1->coreid];
-                long req2Count = this->ctrl->numRequestsPerCore[req2->coreid];
+                long req1Count =
+                    this->ctrl->numRequestsPerCore[req1->req->coreid];
+                long req2Count =
+                    this->ctrl->numRequestsPerCore[req2->req->coreid];
 
                 // Prioritize the list with the least number of requests
                 if (req1Count < req2Count) {
@@ -311,8 +466,8 @@ namespace ramulator {
                 // * Large core prioritization
 
                 // Prioritize the larger cores that need more memory
-                int prio1 = this->ctrl->priority[req1->coreid];
-                int prio2 = this->ctrl->priority[req2->coreid];
+                int prio1 = this->ctrl->priority[req1->req->coreid];
+                int prio2 = this->ctrl->priority[req2->req->coreid];
 
                 if (prio1 > prio2) {
                     return req1;
@@ -322,20 +477,19 @@ namespace ramulator {
 
                 // Otherwise, handle ties with FCFS
 
-                bool ready1 =
-                    this->ctrl->is_ready(req1) && this->ctrl->is_row_hit(req1);
-                bool ready2 =
-                    this->ctrl->is_ready(req2) && this->ctrl->is_row_hit(req2);
+                bool ready1 = req1->ready && req1->hit;
+                bool ready2 = req2->ready && req2->hit;
 
                 if (ready1 ^ ready2) {
                     if (ready1) return req1;
                     return req2;
                 }
 
-                if (req1->arrive <= req2->arrive) return req1;
+                if (req1->req->arrive <= req2->req->arrive) return req1;
                 return req2;
                 // 18-740: ADD CODE ABOVE THIS LINE
-            }};
+            }
+        };
     };
 
     // Row Precharge Policy
@@ -356,43 +510,70 @@ namespace ramulator {
 
         RowPolicy(Controller<T>* ctrl) : ctrl(ctrl) {}
 
+        // Address of the row group (bank or subarray) whose row should be
+        // closed with cmd, or nullptr if there is none
+        const vector<int>* find_victim(typename T::Command cmd) {
+            switch (type) {
+                case Type::Closed:
+                case Type::ClosedAP:
+                    return find_victim<ClosedPolicy>(cmd);
+                case Type::Timeout:
+                    return find_victim<TimeoutPolicy>(cmd);
+                default:  // Opened
+                    return nullptr;
+            }
+        }
+
         vector<int> get_victim(typename T::Command cmd) {
-            return policy[int(type)](cmd);
+            const vector<int>* victim = find_victim(cmd);
+            return victim ? *victim : vector<int>();
+        }
+
+        // Earliest cycle at which get_victim() may return a row, LONG_MAX
+        // if no open row will ever be closed by the policy.
+        long get_next_victim(typename T::Command cmd) {
+            if (type == Type::Opened) return LONG_MAX;
+
+            long next = LONG_MAX;
+            auto& table = ctrl->rowtable->table;
+            for (size_t bank = 0; bank < table.size(); bank++) {
+                if (table[bank].row < 0) continue;
+                long when = ctrl->channel->get_next(
+                    cmd, ctrl->rowtable->rowgroups[bank].data());
+                if (type == Type::Timeout)
+                    when = max(when, table[bank].timestamp + timeout);
+                next = min(next, when);
+            }
+            return next;
         }
 
     private:
-        function<vector<int>(typename T::Command)> policy[int(Type::MAX)] = {
-            // Closed
-            [this](typename T::Command cmd) -> vector<int> {
-                for (auto& kv : this->ctrl->rowtable->table) {
-                    if (!this->ctrl->is_ready(cmd, kv.first)) continue;
-                    return kv.first;
-                }
-                return vector<int>();
-            },
-
-            // ClosedAP
-            [this](typename T::Command cmd) -> vector<int> {
-                for (auto& kv : this->ctrl->rowtable->table) {
-                    if (!this->ctrl->is_ready(cmd, kv.first)) continue;
-                    return kv.first;
-                }
-                return vector<int>();
-            },
-
-            // Opened
-            [this](typename T::Command cmd) { return vector<int>(); },
-
-            // Timeout
-            [this](typename T::Command cmd) -> vector<int> {
-                for (auto& kv : this->ctrl->rowtable->table) {
-                    auto& entry = kv.second;
-                    if (this->ctrl->clk - entry.timestamp < timeout) continue;
-                    if (!this->ctrl->is_ready(cmd, kv.first)) continue;
-                    return kv.first;
-                }
-                return vector<int>();
-            }};
+        // Whether a policy lets an open row be closed, given the last time
+        // it was accessed. The row must also be ready to close.
+        struct ClosedPolicy {
+            static bool may_close(const RowPolicy* policy, long timestamp) {
+                return true;
+            }
+        };
+
+        struct TimeoutPolicy {
+            static bool may_close(const RowPolicy* policy, long timestamp) {
+                return policy->ctrl->clk - timestamp >= policy->timeout;
+            }
+        };
+
+        template <typename Policy>
+        const vector<int>* find_victim(typename T::Command cmd) {
+            auto& table = ctrl->rowtable->table;
+            auto& rowgroups = ctrl->rowtable->rowgroups;
+            for (size_t bank = 0; bank < table.size(); bank++) {
+                if (table[bank].row < 0) continue;
+                if (!Policy::may_close(this, table[bank].timestamp)) continue;
+                if (!ctrl->is_ready(cmd, rowgroups[bank])) continue;
+                return &rowgroups[bank];
+            }
+            return nullptr;
+        }
     };
 
     template <typename T>
@@ -401,33 +582,57 @@ namespace ramulator {
         Controller<T>* ctrl;
 
         struct Entry {
-            int row;
-            int hits;
-            long timestamp;
+            int row = -1;  // -1 if the row group has no open row
+            int hits = 0;
+            long timestamp = 0;
         };
 
-        map<vector<int>, Entry> table;
+        // Open row of every row group (bank or subarray), indexed by
+        // Controller::get_bank(), with the address of each row group (-1
+        // from Row down)
+        vector<Entry> table;
+        vector<vector<int>> rowgroups;
 
         RowTable(Controller<T>* ctrl) : ctrl(ctrl) {}
 
+        // Called once the controller knows its banks
+        void init() {
+            table.assign(ctrl->bank_num, Entry());
+            rowgroups.assign(ctrl->bank_num,
+                             vector<int>(int(T::Level::MAX), -1));
+            for (int bank = 0; bank < ctrl->bank_num; bank++) {
+                vector<int>& rowgroup = rowgroups[bank];
+                rowgroup[0] = ctrl->channel->id;
+                for (int lev = 1; lev < int(T::Level::Row); lev++) {
+                    rowgroup[lev] =
+                        bank / ctrl->bank_stride[lev] %
+                        ctrl->channel->spec->org_entry.count[lev];
+                }
+            }
+        }
+
         void update(typename T::Command cmd, const vector<int>& addr_vec,
                     long clk) {
-            auto begin = addr_vec.begin();
-            auto end = begin + int(T::Level::Row);
-            vector<int> rowgroup(begin, end);  // bank or subarray
-            int row = *end;
+            int row = addr_vec[int(T::Level::Row)];
 
             T* spec = ctrl->channel->spec;
 
-            if (spec->is_opening(cmd)) table.insert({rowgroup, {row, 0, clk}});
+            if (spec->is_opening(cmd)) {
+                Entry& entry = table[ctrl->get_bank(addr_vec)];
+                if (entry.row < 0) {
+                    entry.row = row;
+                    entry.hits = 0;
+                    entry.timestamp = clk;
+                }
+            }
 
             if (spec->is_accessing(cmd)) {
                 // we are accessing a row -- update its entry
-                auto match = table.find(rowgroup);
-                assert(match != table.end());
-                assert(match->second.row == row);
-                match->second.hits++;
-                match->second.timestamp = clk;
+                Entry& entry = table[ctrl->get_bank(addr_vec)];
+                assert(entry.row >= 0);
+                assert(entry.row == row);
+                entry.hits++;
+                entry.timestamp = clk;
             } /* accessing */
 
             if (spec->is_closing(cmd)) {
@@ -440,12 +645,13 @@ namespace ramulator {
                 else
                     scope = int(spec->scope[int(cmd)]);
 
-                for (auto it = table.begin(); it != table.end();) {
-                    if (equal(begin, begin + scope + 1, it->first.begin())) {
+                int first, num;
+                ctrl->get_bank_range(scope, addr_vec, first, num);
+                for (int bank = first; bank < first + num; bank++) {
+                    if (table[bank].row >= 0) {
                         n_rm++;
-                        it = table.erase(it);
-                    } else
-                        it++;
+                        table[bank].row = -1;
+                    }
                 }
 
                 assert(n_rm > 0);
@@ -454,30 +660,17 @@ namespace ramulator {
 
         int get_hits(const vector<int>& addr_vec,
                      const bool to_opened_row = false) {
-            auto begin = addr_vec.begin();
-            auto end = begin + int(T::Level::Row);
+            Entry& entry = table[ctrl->get_bank(addr_vec)];
+            if (entry.row < 0) return 0;
 
-            vector<int> rowgroup(begin, end);
-            int row = *end;
+            if (!to_opened_row && (entry.row != addr_vec[int(T::Level::Row)]))
+                return 0;
 
-            auto itr = table.find(rowgroup);
-            if (itr == table.end()) return 0;
-
-            if (!to_opened_row && (itr->second.row != row)) return 0;
-
-            return itr->second.hits;
+            return entry.hits;
         }
 
         int get_open_row(const vector<int>& addr_vec) {
-            auto begin = addr_vec.begin();
-            auto end = begin + int(T::Level::Row);
-
-            vector<int> rowgroup(begin, end);
-
-            auto itr = table.find(rowgroup);
-            if (itr == table.end()) return -1;
-
-            return itr->second.row;
+            return table[ctrl->get_bank(addr_vec)].row;
         }
     };
 
@@ -0,0 +1,120 @@
+#ifndef __TIMESERIES_H
+#define __TIMESERIES_H
+
+#include <cassert>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Config.h"
+
+namespace ramulator {
+
+    // Counters sampled every `interval` cycles of their owner's clock,
+    // kept in memory one column per counter and written out when the
+    // series is dumped (or destroyed).
+    //
+    // Config options:
+    //   stats_interval      - cycles between samples, 0 for none (default)
+    //   stats_series_prefix - path prefix of the files (default "series-")
+    //   stats_series_format - csv (default) or binary. The binary file is
+    //                         "RAMTSERS", the number of columns (uint32)
+    //                         and of samples (uint64), the column names
+    //                         (a length byte and the characters each),
+    //                         then each column as uint64 values, all in
+    //                         host byte order. The first column is clk.
+    class TimeSeries {
+    public:
+        TimeSeries(const std::string& path, long interval, bool binary)
+            : path(path + (binary ? ".bin" : ".csv")),
+              interval(interval),
+              next(interval),
+              binary(binary) {
+            assert(interval > 0);
+            add("clk", [this] { return uint64_t(sampling); });
+        }
+
+        ~TimeSeries() { dump(); }
+
+        // The series named name in configs, nullptr if none is sampled
+        static TimeSeries* create(const Config& configs,
+                                  const std::string& name) {
+            if (!configs.contains("stats_interval")) return nullptr;
+            long interval = std::stol(configs["stats_interval"]);
+            if (interval <= 0) return nullptr;
+            std::string prefix = configs.contains("stats_series_prefix")
+                                     ? configs["stats_series_prefix"]
+                                     : "series-";
+            return new TimeSeries(prefix + name, interval,
+                                  configs["stats_series_format"] == "binary");
+        }
+
+        // Columns must be added before the first sample
+        void add(const std::string& name, std::function<uint64_t()> read) {
+            assert(columns.empty() || columns[0].empty());
+            names.push_back(name);
+            readers.push_back(read);
+            columns.emplace_back();
+        }
+
+        // Take the samples due at or before clk. The counters did not
+        // change in cycles that were skipped, so their samples are equal.
+        void sample(long clk) {
+            while (clk >= next) {
+                sampling = next;
+                for (size_t i = 0; i < readers.size(); i++)
+                    columns[i].push_back(readers[i]());
+                next += interval;
+            }
+        }
+
+        void dump() {
+            if (dumped) return;
+            dumped = true;
+
+            std::ofstream file(path, std::ios::binary);
+            size_t rows = columns[0].size();
+            if (binary) {
+                uint32_t num = columns.size();
+                uint64_t len = rows;
+                file << "RAMTSERS";
+                file.write((const char*)&num, sizeof(num));
+                file.write((const char*)&len, sizeof(len));
+                for (auto& name : names) {
+                    assert(name.size() < 256);
+                    file << char(name.size()) << name;
+                }
+                for (auto& column : columns)
+                    file.write((const char*)column.data(),
+                               column.size() * sizeof(uint64_t));
+                return;
+            }
+
+            for (size_t i = 0; i < names.size(); i++)
+                file << (i ? "," : "") << names[i];
+            file << '\n';
+            for (size_t row = 0; row < rows; row++) {
+                for (size_t i = 0; i < columns.size(); i++)
+                    file << (i ? "," : "") << columns[i][row];
+                file << '\n';
+            }
+        }
+
+    private:
+        std::string path;
+        long interval;
+        long next;      // cycle of the next sample
+        long sampling;  // cycle of the sample being taken
+        bool binary;
+        bool dumped = false;
+
+        std::vector<std::string> names;
+        std::vector<std::function<uint64_t()>> readers;
+        std::vector<std::vector<uint64_t>> columns;
+    };
+
+}  // namespace ramulator
+
+#endif /* __TIMESERIES_H */
@@ -0,0 +1,86 @@
+#include "UCP.h"
+#include <algorithm>
+
+namespace ramulator {
+
+    const int UCP::sampled_sets;
+
+    UCP::UCP(int cores, int sets, int assoc, long epoch)
+        : parts(std::min(cores, assoc)),
+          assoc(assoc),
+          sample_stride(std::max(1, sets / sampled_sets)),
+          monitored((sets + sample_stride - 1) / sample_stride),
+          epoch(epoch),
+          next_epoch(epoch) {
+        assert(epoch > 0);
+
+        // Start from an equal share of the ways
+        quota.assign(parts, assoc / parts);
+        for (int part = 0; part < assoc % parts; part++) quota[part]++;
+
+        shadow_tags.assign(size_t(parts) * monitored * assoc, -1);
+        hits.assign(size_t(parts) * assoc, 0);
+    }
+
+    void UCP::access(int core, int set, long tag, long clk) {
+        if (clk >= next_epoch) {
+            repartition();
+            next_epoch = (clk / epoch + 1) * epoch;
+        }
+        if (set % sample_stride) return;
+
+        int part = partition(core);
+        long* stack = &shadow_tags[(size_t(part) * monitored +
+                                    set / sample_stride) *
+                                   assoc];
+        int pos = 0;
+        while (pos < assoc - 1 && stack[pos] != tag) pos++;
+        if (stack[pos] == tag) hits[size_t(part) * assoc + pos]++;
+
+        // Move the tag to the most recent position; a miss drops the
+        // least recent one
+        std::copy_backward(stack, stack + pos, stack + pos + 1);
+        stack[0] = tag;
+    }
+
+    long UCP::utility(int part, int ways) const {
+        const long* part_hits = &hits[size_t(part) * assoc];
+        long sum = 0;
+        for (int pos = 0; pos < ways; pos++) sum += part_hits[pos];
+        return sum;
+    }
+
+    void UCP::repartition() {
+        std::vector<int> alloc(parts, 1);
+        int balance = assoc - parts;
+
+        while (balance > 0) {
+            // The partition with the most hits per extra way, looking
+            // ahead over every number of extra ways it could take. Ties go
+            // to the partition with fewer ways.
+            int winner = 0, winner_ways = 1;
+            double winner_mu = -1;
+            for (int part = 0; part < parts; part++) {
+                long base = utility(part, alloc[part]);
+                for (int ways = 1; ways <= balance; ways++) {
+                    double mu =
+                        double(utility(part, alloc[part] + ways) - base) /
+                        ways;
+                    if (mu > winner_mu ||
+                        (mu == winner_mu && alloc[part] < alloc[winner])) {
+                        winner = part;
+                        winner_ways = ways;
+                        winner_mu = mu;
+                    }
+                }
+            }
+            alloc[winner] += winner_ways;
+            balance -= winner_ways;
+        }
+
+        quota = alloc;
+        repartitions++;
+        for (auto& count : hits) count /= 2;
+    }
+
+}  // namespace ramulator
@@ -0,0 +1,56 @@
+#ifndef __UCP_H
+#define __UCP_H
+
+#include <cassert>
+#include <vector>
+
+namespace ramulator {
+
+    // Utility-based cache partitioning (Qureshi and Patt, MICRO 2006).
+    // A utility monitor per core keeps LRU shadow tags of a sample of the
+    // sets, as if the core had the whole cache, and counts its hits at
+    // each recency position. Every epoch the lookahead algorithm hands
+    // out the ways to the cores whose hits grow the most per extra way,
+    // and the counters are halved so that older phases fade out.
+    //
+    // Every partition keeps at least one way, so with more cores than ways
+    // the cores share assoc partitions, core c the partition c % assoc,
+    // and a monitor counts the hits of all the cores of its partition.
+    class UCP {
+    public:
+        // Ways of a set each partition may keep lines in, summing to assoc
+        std::vector<int> quota;
+        long repartitions = 0;
+
+        UCP(int cores, int sets, int assoc, long epoch);
+
+        int partitions() const { return parts; }
+        int partition(int core) const { return core % parts; }
+
+        // An access of core to the line with tag in set, at cycle clk
+        void access(int core, int set, long tag, long clk);
+
+    private:
+        static const int sampled_sets = 32;
+
+        int parts;
+        int assoc;
+        int sample_stride;  // every sample_stride-th set is monitored
+        int monitored;      // number of monitored sets
+        long epoch;
+        long next_epoch;
+
+        // Shadow tags per partition and sampled set, most recent first, -1
+        // if invalid, and the hits at each recency position per partition
+        std::vector<long> shadow_tags;
+        std::vector<long> hits;
+
+        // Hits of part with ways ways
+        long utility(int part, int ways) const;
+
+        void repartition();
+    };
+
+}  // namespace ramulator
+
+#endif /* __UCP_H */
@@ -0,0 +1,61 @@
+#ifndef __WRITEBACK_LINK_H
+#define __WRITEBACK_LINK_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Config.h"
+#include "PerConfig.h"
+
+namespace ramulator {
+
+    // DRAM-aware writeback (Lee et al., 2010). Dirty lines otherwise
+    // leave the last level cache only when they are evicted, in no
+    // particular row order. In write mode, a memory controller that serves
+    // the last queued write to a row asks the cache for its other dirty
+    // lines in that row, while the row is still open, and queues them as
+    // row hit writes. The cache marks them clean so they are not written
+    // again on eviction. One link is shared by the cache and the
+    // controllers built from the same Config.
+    //
+    // Config options:
+    //   dram_aware_writeback - on, or off (default). Needs the default
+    //                          RoBaRaCoCh address mapping, and cache lines
+    //                          of one DRAM transaction.
+    class WritebackLink {
+    public:
+        // Set by the last level cache: clean at most max of the dirty
+        // lines among addrs, and append their addresses to out
+        std::function<void(const std::vector<long>& addrs, size_t max,
+                           std::vector<long>& out)>
+            clean;
+
+        // A line is written back as one write, so the cache line and the
+        // DRAM transaction must be the same size. Each side sets its size,
+        // and the second one is checked against the first.
+        void set_line_size(long size) {
+            if (line_size && line_size != size) {
+                fprintf(stderr,
+                        "dram_aware_writeback needs cache lines of one DRAM "
+                        "transaction, not %ld and %ld bytes\n",
+                        line_size, size);
+                exit(1);
+            }
+            line_size = size;
+        }
+
+        // The link of the cache and channels built from configs
+        static std::shared_ptr<WritebackLink> get(const Config& configs) {
+            return shared_per_config<WritebackLink>(configs);
+        }
+
+    private:
+        long line_size = 0;
+    };
+
+}  // namespace ramulator
+
+#endif /* __WRITEBACK_LINK_H */